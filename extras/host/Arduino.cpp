@@ -0,0 +1,143 @@
+/*
+
+  Copyright (C) CBUS library contributors 2026
+
+  This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include <Arduino.h>
+
+#include <chrono>
+#include <thread>
+#include <stdio.h>
+
+HostSerial Serial;
+
+static uint8_t simulated_pins[256];
+
+//
+/// time is measured from the first call, like the Arduino core which counts from reset
+//
+
+static std::chrono::steady_clock::time_point start_time(void) {
+
+  static const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  return t0;
+}
+
+unsigned long micros(void) {
+
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time()).count();
+}
+
+unsigned long millis(void) {
+
+  return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time()).count();
+}
+
+void delay(unsigned long ms) {
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+//
+/// simulated digital IO
+//
+
+void pinMode(uint8_t pin, uint8_t mode) {
+
+  if (mode == INPUT_PULLUP) {
+    simulated_pins[pin] = HIGH;
+  }
+}
+
+int digitalRead(uint8_t pin) {
+
+  return simulated_pins[pin];
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+
+  simulated_pins[pin] = val;
+}
+
+void setSimulatedPin(uint8_t pin, uint8_t val) {
+
+  simulated_pins[pin] = val;
+}
+
+//
+/// serial output to stdout
+//
+
+void HostSerial::flush(void) {
+
+  fflush(stdout);
+}
+
+size_t HostSerial::print(const char *s) {
+
+  return fputs(s, stdout) < 0 ? 0 : strlen(s);
+}
+
+size_t HostSerial::print(const __FlashStringHelper *s) {
+
+  return print(reinterpret_cast<const char *>(s));
+}
+
+size_t HostSerial::print(char c) {
+
+  return fputc(c, stdout) == EOF ? 0 : 1;
+}
+
+size_t HostSerial::print(long n, int base) {
+
+  int r = (base == 16) ? printf("%lx", n) : printf("%ld", n);
+  return r < 0 ? 0 : r;
+}
+
+size_t HostSerial::print(unsigned long n, int base) {
+
+  int r = (base == 16) ? printf("%lx", n) : printf("%lu", n);
+  return r < 0 ? 0 : r;
+}
+
+size_t HostSerial::print(double d, int digits) {
+
+  int r = printf("%.*f", digits, d);
+  return r < 0 ? 0 : r;
+}
@@ -0,0 +1,230 @@
+/*
+
+  Copyright (C) CBUS library contributors 2026
+
+  This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include <CBUSHost.h>
+
+CBUSHost::CBUSHost() {
+
+}
+
+CBUSHost::CBUSHost(CBUSConfig *the_config) : CBUSbase(the_config) {
+
+}
+
+//
+/// nothing to initialise for the in-memory transport
+//
+
+bool CBUSHost::begin(bool poll, SPIClass & spi) {
+
+  (void)poll;
+  (void)spi;
+
+  _numMsgsSent = 0;
+  _numMsgsRcvd = 0;
+  return true;
+}
+
+//
+/// check for one or more received frames
+//
+
+bool CBUSHost::available(void) {
+
+  receiveFrames();
+  return !_rx_queue.empty();
+}
+
+//
+/// get the next received frame
+//
+
+CANFrame CBUSHost::getNextMessage(void) {
+
+  CANFrame msg;
+
+  receiveFrames();
+  _rx_queue.get(&msg);
+  ++_numMsgsRcvd;
+  return msg;
+}
+
+//
+/// get up to max_msgs received frames in one call
+//
+
+byte CBUSHost::getNextMessages(CANFrame *msgs, byte max_msgs) {
+
+  byte count = 0;
+
+  receiveFrames();
+
+  while (count < max_msgs && _rx_queue.get(&msgs[count])) {
+    ++count;
+  }
+
+  _numMsgsRcvd += count;
+  return count;
+}
+
+//
+/// send a frame with the header set from our CANID and the priority
+/// the frame is stored in the transmit queue and delivered to any connected peers
+//
+
+bool CBUSHost::sendMessage(CANFrame *msg, bool rtr, bool ext, byte priority) {
+
+  makeHeader(msg, priority);
+  msg->rtr = rtr;
+  msg->ext = ext;
+
+  return sendMessageNoUpdate(msg);
+}
+
+//
+/// send a frame as-is
+/// fails if the simulated controller's transmit buffers are full
+//
+
+bool CBUSHost::sendMessageNoUpdate(CANFrame *msg) {
+
+  if (_tx_capacity > 0 && _tx_queue.size() >= _tx_capacity) {
+    return false;
+  }
+
+  _tx_queue.push_back(*msg);
+
+  for (size_t i = 0; i < _peers.size(); i++) {
+    _peers[i]->inject(msg);
+  }
+
+  if (transmithandler != nullptr) {
+    (void)(*transmithandler)(msg);
+  }
+
+  ++_numMsgsSent;
+  return true;
+}
+
+//
+/// discard all queued frames
+//
+
+void CBUSHost::reset(void) {
+
+  _bus_queue.clear();
+  _rx_queue.clear();
+  _tx_queue.clear();
+}
+
+//
+/// move frames from the simulated bus into the receive buffer while it has room
+//
+
+void CBUSHost::receiveFrames(void) {
+
+  while (!_bus_queue.empty() && receiveFrame(&_bus_queue.front())) {
+    _bus_queue.pop_front();
+  }
+}
+
+//
+/// put a frame into the receive buffer, as the CAN receive interrupt does
+/// this may run in another thread, concurrently with process(), as the buffer's only producer
+/// returns false, and counts an overflow, if the buffer is full
+//
+
+bool CBUSHost::receiveFrame(const CANFrame *msg) {
+
+  return _rx_queue.put(msg);
+}
+
+//
+/// harness methods
+//
+
+void CBUSHost::inject(const CANFrame *msg) {
+
+  _bus_queue.push_back(*msg);
+}
+
+void CBUSHost::inject(const CANFrame *msgs, size_t num_msgs) {
+
+  _bus_queue.insert(_bus_queue.end(), msgs, msgs + num_msgs);
+}
+
+unsigned int CBUSHost::pendingMessages(void) {
+
+  receiveFrames();
+  return _rx_queue.size();
+}
+
+bool CBUSHost::getSentMessage(CANFrame *msg) {
+
+  if (_tx_queue.empty()) {
+    return false;
+  }
+
+  *msg = _tx_queue.front();
+  _tx_queue.pop_front();
+  return true;
+}
+
+unsigned int CBUSHost::sentCount(void) {
+
+  return _tx_queue.size();
+}
+
+void CBUSHost::clearSent(void) {
+
+  _tx_queue.clear();
+}
+
+void CBUSHost::connect(CBUSHost *peer) {
+
+  _peers.push_back(peer);
+  peer->_peers.push_back(this);
+}
+
+//
+/// limit the number of sent frames held until collected with getSentMessage(), to simulate a busy bus
+/// zero means no limit
+//
+
+void CBUSHost::setTxCapacity(unsigned int capacity) {
+
+  _tx_capacity = capacity;
+}
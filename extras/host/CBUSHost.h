@@ -0,0 +1,96 @@
+/*
+
+  Copyright (C) CBUS library contributors 2026
+
+  This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+//
+/// a concrete CBUS class for host builds, backed by in-memory receive and transmit queues
+/// the harness injects frames with inject() and collects sent frames with getSentMessage()
+/// injected frames wait on the simulated bus and are moved into a fixed receive buffer as it has room,
+/// as a CAN controller would fill a driver's receive buffer from its interrupt
+/// the receive buffer is a lock-free single-producer, single-consumer ring, so receiveFrame() may also be
+/// called from a second thread while process() runs, in place of inject()
+/// two objects can be joined with connect() to form a simple bus
+//
+
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include <CBUS.h>
+
+// the receive buffer size of the larger boards' drivers
+
+static const unsigned int HOST_RX_BUFFER_SIZE = 1024;
+
+class CBUSHost : public CBUSbase {
+
+public:
+  CBUSHost();
+  CBUSHost(CBUSConfig *the_config);
+
+  // these methods are declared virtual in the base class and must be implemented by the derived class
+
+  bool begin(bool poll = false, SPIClass & spi = SPI);
+  bool available(void);
+  CANFrame getNextMessage(void);
+  bool sendMessage(CANFrame *msg, bool rtr = false, bool ext = false, byte priority = DEFAULT_PRIORITY);
+  bool sendMessageNoUpdate(CANFrame *msg);
+  void reset(void);
+
+  // exact count of received frames, and batch retrieval
+
+  unsigned int pendingMessages(void);
+  byte getNextMessages(CANFrame *msgs, byte max_msgs);
+
+  // host harness methods
+
+  void inject(const CANFrame *msg);
+  void inject(const CANFrame *msgs, size_t num_msgs);
+  bool receiveFrame(const CANFrame *msg);
+  bool getSentMessage(CANFrame *msg);
+  unsigned int sentCount(void);
+  void clearSent(void);
+  void connect(CBUSHost *peer);
+  void setTxCapacity(unsigned int capacity);
+
+private:
+  void receiveFrames(void);
+
+  std::deque<CANFrame> _bus_queue, _tx_queue;
+  circular_buffer_spsc<CANFrame, HOST_RX_BUFFER_SIZE> _rx_queue;
+  unsigned int _tx_capacity = 0;
+  std::vector<CBUSHost *> _peers;
+};
@@ -0,0 +1,298 @@
+/*
+
+  Copyright (C) CBUS library contributors 2026
+
+  This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include <CBUSconfig.h>
+
+//
+/// the EEPROM layout follows the Arduino library:
+///   0 = FLiM flag, 1 = CANID, 2-3 = node number, NVs from EE_NVS_START, events from EE_EVENTS_START
+///   each event is 4 bytes of NN/EN followed by EE_NUM_EVS event variables; 0xff = erased
+/// the sketch sets the EE_ sizes and then calls begin(), as on the target
+//
+
+CBUSConfig::CBUSConfig() {
+
+  EE_NVS_START = 10;
+  EE_NUM_NVS = 0;
+  EE_EVENTS_START = 10;
+  EE_MAX_EVENTS = 0;
+  EE_NUM_EVS = 0;
+  EE_BYTES_PER_EVENT = 4;
+
+  CANID = 0;
+  FLiM = false;
+  nodeNum = 0;
+
+  memset(evhashtbl, 0, sizeof(evhashtbl));
+  memset(eeprom, 0xff, sizeof(eeprom));
+  resetEEPROMCounters();
+}
+
+void CBUSConfig::begin(void) {
+
+  EE_EVENTS_START = EE_NVS_START + EE_NUM_NVS;
+  EE_BYTES_PER_EVENT = EE_NUM_EVS + 4;
+
+  FLiM = (readEEPROM(0) == 1);
+  CANID = readEEPROM(1);
+  nodeNum = (readEEPROM(2) << 8) + readEEPROM(3);
+
+  if (CANID == 0xff) {
+    CANID = 0;
+  }
+
+  if (nodeNum == 0xffff) {
+    nodeNum = 0;
+  }
+
+  makeEvHashTable();
+}
+
+//
+/// hash table of stored events, one byte per event slot, zero = unused
+//
+
+byte CBUSConfig::makeHash(byte tarr[]) {
+
+  byte hash = tarr[0] ^ tarr[1] ^ tarr[2] ^ tarr[3];
+
+  if (hash == 0) {
+    hash = 0xff;
+  }
+
+  return hash;
+}
+
+void CBUSConfig::makeEvHashTable(void) {
+
+  for (byte i = 0; i < EE_MAX_EVENTS; i++) {
+    updateEvHashEntry(i);
+  }
+}
+
+void CBUSConfig::updateEvHashEntry(byte idx) {
+
+  byte tarr[4];
+  readEvent(idx, tarr);
+
+  if (tarr[0] == 0xff && tarr[1] == 0xff && tarr[2] == 0xff && tarr[3] == 0xff) {
+    evhashtbl[idx] = 0;
+  } else {
+    evhashtbl[idx] = makeHash(tarr);
+  }
+
+}
+
+void CBUSConfig::clearEvHashTable(void) {
+
+  for (byte i = 0; i < EE_MAX_EVENTS; i++) {
+    evhashtbl[i] = 0;
+  }
+}
+
+byte CBUSConfig::getEvTableEntry(byte tindex) {
+
+  return (tindex < EE_MAX_EVENTS) ? evhashtbl[tindex] : 0;
+}
+
+byte CBUSConfig::numEvents(void) {
+
+  byte numevents = 0;
+
+  for (byte i = 0; i < EE_MAX_EVENTS; i++) {
+    if (evhashtbl[i] != 0) {
+      ++numevents;
+    }
+  }
+
+  return numevents;
+}
+
+//
+/// event lookup using the hash table, with each hash match confirmed from EEPROM
+/// returns EE_MAX_EVENTS if not found
+//
+
+byte CBUSConfig::findExistingEvent(unsigned int nn, unsigned int en) {
+
+  byte tarr[4], tmp[4];
+  byte i;
+
+  tarr[0] = highByte(nn);
+  tarr[1] = lowByte(nn);
+  tarr[2] = highByte(en);
+  tarr[3] = lowByte(en);
+
+  byte hash = makeHash(tarr);
+
+  for (i = 0; i < EE_MAX_EVENTS; i++) {
+    if (evhashtbl[i] == hash) {
+      readEvent(i, tmp);
+
+      if (memcmp(tarr, tmp, 4) == 0) {
+        break;
+      }
+    }
+  }
+
+  return i;
+}
+
+byte CBUSConfig::findEventSpace(void) {
+
+  byte evidx;
+
+  for (evidx = 0; evidx < EE_MAX_EVENTS; evidx++) {
+    if (evhashtbl[evidx] == 0) {
+      break;
+    }
+  }
+
+  return evidx;
+}
+
+//
+/// event and event variable storage
+//
+
+void CBUSConfig::readEvent(byte idx, byte tarr[]) {
+
+  unsigned int eeaddress = EE_EVENTS_START + (idx * EE_BYTES_PER_EVENT);
+
+  for (byte i = 0; i < 4; i++) {
+    tarr[i] = readEEPROM(eeaddress + i);
+  }
+}
+
+void CBUSConfig::writeEvent(byte index, byte data[]) {
+
+  unsigned int eeaddress = EE_EVENTS_START + (index * EE_BYTES_PER_EVENT);
+
+  for (byte i = 0; i < 4; i++) {
+    writeEEPROM(eeaddress + i, data[i]);
+  }
+}
+
+void CBUSConfig::cleareventEEPROM(byte index) {
+
+  unsigned int eeaddress = EE_EVENTS_START + (index * EE_BYTES_PER_EVENT);
+
+  for (byte i = 0; i < EE_BYTES_PER_EVENT; i++) {
+    writeEEPROM(eeaddress + i, 0xff);
+  }
+}
+
+byte CBUSConfig::getEventEVval(byte idx, byte evnum) {
+
+  return readEEPROM(EE_EVENTS_START + (idx * EE_BYTES_PER_EVENT) + 3 + evnum);
+}
+
+void CBUSConfig::writeEventEV(byte idx, byte evnum, byte evval) {
+
+  writeEEPROM(EE_EVENTS_START + (idx * EE_BYTES_PER_EVENT) + 3 + evnum, evval);
+}
+
+//
+/// node variables are indexed from 1
+//
+
+byte CBUSConfig::readNV(byte idx) {
+
+  return readEEPROM(EE_NVS_START + (idx - 1));
+}
+
+void CBUSConfig::writeNV(byte idx, byte val) {
+
+  writeEEPROM(EE_NVS_START + (idx - 1), val);
+}
+
+//
+/// module state
+//
+
+void CBUSConfig::setCANID(byte canid) {
+
+  CANID = canid;
+  writeEEPROM(1, canid);
+}
+
+void CBUSConfig::setFLiM(bool f) {
+
+  FLiM = f;
+  writeEEPROM(0, f);
+}
+
+void CBUSConfig::setNodeNum(unsigned int nn) {
+
+  nodeNum = nn;
+  writeEEPROM(2, highByte(nn));
+  writeEEPROM(3, lowByte(nn));
+}
+
+void CBUSConfig::resetModule(void) {
+
+  memset(eeprom, 0xff, sizeof(eeprom));
+  writeEEPROM(0, 0);
+  writeEEPROM(1, 0);
+  writeEEPROM(2, 0);
+  writeEEPROM(3, 0);
+  begin();
+}
+
+//
+/// simulated EEPROM access
+//
+
+byte CBUSConfig::readEEPROM(unsigned int eeaddress) {
+
+  ++eeprom_reads;
+  return (eeaddress < EEPROM_SIZE) ? eeprom[eeaddress] : 0xff;
+}
+
+void CBUSConfig::writeEEPROM(unsigned int eeaddress, byte data) {
+
+  ++eeprom_writes;
+
+  if (eeaddress < EEPROM_SIZE) {
+    eeprom[eeaddress] = data;
+  }
+}
+
+void CBUSConfig::resetEEPROMCounters(void) {
+
+  eeprom_reads = 0;
+  eeprom_writes = 0;
+}
@@ -0,0 +1,125 @@
+/*
+
+  Copyright (C) CBUS library contributors 2026
+
+  This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include <CBUSswitch.h>
+
+CBUSSwitch::CBUSSwitch() {
+
+  _pin = 255;
+  _pressedState = LOW;
+  _pressed = false;
+  _requested = false;
+  _stateChanged = false;
+  _lastStateChangeTime = 0;
+  _lastStateDuration = 0;
+}
+
+void CBUSSwitch::setPin(byte pin, byte pressedState) {
+
+  _pin = pin;
+  _pressedState = pressedState;
+}
+
+//
+/// apply any state change requested by the harness since the last run
+//
+
+void CBUSSwitch::run(void) {
+
+  _stateChanged = false;
+
+  if (_requested != _pressed) {
+    unsigned long now = millis();
+    _lastStateDuration = now - _lastStateChangeTime;
+    _lastStateChangeTime = now;
+    _pressed = _requested;
+    _stateChanged = true;
+  }
+}
+
+void CBUSSwitch::reset(void) {
+
+  _pressed = false;
+  _requested = false;
+  _stateChanged = false;
+  _lastStateChangeTime = millis();
+  _lastStateDuration = 0;
+}
+
+bool CBUSSwitch::stateChanged(void) {
+
+  return _stateChanged;
+}
+
+bool CBUSSwitch::getState(void) {
+
+  return _pressed ? _pressedState : !_pressedState;
+}
+
+bool CBUSSwitch::isPressed(void) {
+
+  return _pressed;
+}
+
+unsigned long CBUSSwitch::getCurrentStateDuration(void) {
+
+  return millis() - _lastStateChangeTime;
+}
+
+unsigned long CBUSSwitch::getLastStateDuration(void) {
+
+  return _lastStateDuration;
+}
+
+unsigned long CBUSSwitch::getLastStateChangeTime(void) {
+
+  return _lastStateChangeTime;
+}
+
+void CBUSSwitch::resetCurrentDuration(void) {
+
+  _lastStateChangeTime = millis();
+}
+
+void CBUSSwitch::press(void) {
+
+  _requested = true;
+}
+
+void CBUSSwitch::release(void) {
+
+  _requested = false;
+}
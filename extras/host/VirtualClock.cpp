@@ -0,0 +1,78 @@
+/*
+
+  Copyright (C) CBUS library contributors 2026
+
+  This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include <VirtualClock.h>
+
+unsigned long long VirtualClock::_now_us = 0;
+
+void VirtualClock::install(void) {
+
+  CBUSClock::setSource(VirtualClock::millis, VirtualClock::micros);
+}
+
+void VirtualClock::uninstall(void) {
+
+  CBUSClock::resetSource();
+}
+
+void VirtualClock::set(unsigned long long us) {
+
+  _now_us = us;
+}
+
+void VirtualClock::advance(unsigned long us) {
+
+  _now_us += us;
+}
+
+void VirtualClock::advanceMillis(unsigned long ms) {
+
+  _now_us += (unsigned long long)ms * 1000ULL;
+}
+
+//
+/// the values wrap as the Arduino functions do, at 32 bits
+//
+
+unsigned long VirtualClock::millis(void) {
+
+  return (uint32_t)(_now_us / 1000ULL);
+}
+
+unsigned long VirtualClock::micros(void) {
+
+  return (uint32_t)_now_us;
+}
@@ -0,0 +1,1029 @@
+/*
+
+  Copyright (C) CBUS library contributors 2026
+
+  This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+//
+/// host benchmark for the CBUS library
+/// drives CBUSbase::process() and CBUSLongMessageEx::process() with synthetic bus traffic
+/// and reports the processing cost per frame and the simulated EEPROM traffic
+/// the library runs on a virtual clock, so timed activity runs faster than real time;
+/// the reported costs are measured in real time
+//
+
+#include <stdio.h>
+#include <thread>
+#include <algorithm>
+
+#include <CBUSHost.h>
+#include <CBUSParams.h>
+#include <VirtualClock.h>
+
+// the module configuration, as defined in a sketch
+
+CBUSConfig config;
+
+static const unsigned int MY_NN = 256;
+static const unsigned int NUM_FRAMES = 200000;
+
+static unsigned long events_consumed = 0;
+
+void eventhandler(byte index, CANFrame *msg, bool ison, byte evval) {
+
+  (void)index;
+  (void)msg;
+  (void)ison;
+  (void)evval;
+  ++events_consumed;
+}
+
+//
+/// build a frame with the given opcode, node number and event number
+//
+
+static CANFrame makeFrame(byte canid, byte opc, unsigned int nn, unsigned int en, byte len = 5) {
+
+  CANFrame frame;
+
+  frame.id = (DEFAULT_PRIORITY << 7) + canid;
+  frame.ext = false;
+  frame.rtr = false;
+  frame.len = len;
+  frame.data[0] = opc;
+  frame.data[1] = highByte(nn);
+  frame.data[2] = lowByte(nn);
+  frame.data[3] = highByte(en);
+  frame.data[4] = lowByte(en);
+  return frame;
+}
+
+//
+/// learn events using the same opcodes as a configuration tool
+//
+
+static void learnEvents(CBUSHost &cbus, unsigned int num_events) {
+
+  CANFrame frame = makeFrame(2, OPC_NNLRN, MY_NN, 0, 3);
+  cbus.inject(&frame);
+
+  for (unsigned int i = 0; i < num_events; i++) {
+    frame = makeFrame(2, OPC_EVLRN, 300, i + 1, 7);
+    frame.data[5] = 1;
+    frame.data[6] = (byte)i;
+    cbus.inject(&frame);
+  }
+
+  frame = makeFrame(2, OPC_NNULN, MY_NN, 0, 3);
+  cbus.inject(&frame);
+
+  while (cbus.pendingMessages() > 0) {
+    cbus.process(255);
+  }
+
+  cbus.clearSent();
+}
+
+//
+/// run the injected frames through process() and report the cost
+//
+
+static void runFrames(CBUSHost &cbus, const char *name, unsigned int num_frames) {
+
+  config.resetEEPROMCounters();
+  events_consumed = 0;
+
+  unsigned long start = micros();
+
+  while (cbus.pendingMessages() > 0) {
+    cbus.process();
+  }
+
+  unsigned long elapsed = micros() - start;
+
+  printf("%-32s %8u frames %10.1f ns/frame %10lu EEPROM reads %8lu events %8u sent\n", name, num_frames,
+         (elapsed * 1000.0) / num_frames, config.eeprom_reads, events_consumed, cbus.sentCount());
+
+  cbus.clearSent();
+}
+
+//
+/// accessory events, most of which are not in the event table
+/// foreign events are drawn from a set of num_foreign distinct (NN, EN) pairs
+//
+
+static void benchAccessoryEvents(CBUSHost &cbus, const char *name, unsigned int num_foreign) {
+
+  for (unsigned int i = 0; i < NUM_FRAMES; i++) {
+    CANFrame frame;
+
+    if (i % 10 == 0) {
+      frame = makeFrame(3, (i % 20 == 0) ? OPC_ACON : OPC_ACOF, 300, (i / 10) % 64 + 1);
+    } else {
+      unsigned int n = i % num_foreign;
+      frame = makeFrame(3, OPC_ACON, 400 + (n % 50), n);
+    }
+
+    cbus.inject(&frame);
+  }
+
+  runFrames(cbus, name, NUM_FRAMES);
+}
+
+//
+/// the same traffic with an event lookup cache
+//
+
+static void benchEventCache(CBUSHost &cbus) {
+
+  static event_cache_entry_t cache[256];
+
+  cbus.setEventCache(cache, 255);
+  cbus._numEventCacheHits = cbus._numEventCacheMisses = 0;
+
+  benchAccessoryEvents(cbus, "accessory events, cached", 128);
+  printf("%-32s %8u hits %8u misses\n", "", cbus._numEventCacheHits, cbus._numEventCacheMisses);
+
+  cbus.setEventCache(nullptr, 0);
+}
+
+//
+/// the same traffic with the event pre-filter
+//
+
+static void benchEventFilter(CBUSHost &cbus) {
+
+  static byte filter[EVENT_FILTER_BYTES(128)];
+
+  cbus.setEventFilter(filter, sizeof(filter));
+  cbus._numEventFilterRejects = 0;
+
+  benchAccessoryEvents(cbus, "accessory events, filtered", 1000);
+  printf("%-32s %8u rejected\n", "", cbus._numEventFilterRejects);
+
+  cbus.setEventFilter(nullptr, 0);
+}
+
+//
+/// the same traffic with two independent components registered for opcode ranges, each with its own context
+//
+
+static void countFrame(CANFrame *msg, void *context) {
+
+  (void)msg;
+  ++*(unsigned long *)context;
+}
+
+static void benchOpcodeHandlers(CBUSHost &cbus) {
+
+  unsigned long on_events = 0, off_events = 0;
+
+  cbus.addOpcodeHandler(OPC_ACON, countFrame, &on_events);
+  cbus.addOpcodeHandler(OPC_ACOF, OPC_ACOF, countFrame, &off_events);
+
+  benchAccessoryEvents(cbus, "accessory events, 2 handlers", 1000);
+  printf("%-32s %8lu on %8lu off\n", "", on_events, off_events);
+
+  cbus.removeOpcodeHandler(countFrame, &on_events);
+  cbus.removeOpcodeHandler(countFrame, &off_events);
+}
+
+//
+/// a flood of learned events, toggling on and off, taken by an application that can only handle one event
+/// for every ten frames received
+//
+
+static void benchEventQueue(CBUSHost &cbus) {
+
+  static consumed_event_t queue[64];
+  static byte pending[EVENT_QUEUE_PENDING_BYTES(128)];
+  consumed_event_t event;
+  unsigned int delivered = 0;
+  byte last_state[64] = {};
+
+  cbus.setEventQueue(queue, 64, pending, sizeof(pending));
+  cbus._numEventsCoalesced = cbus._numEventsDropped = 0;
+  unsigned long start = micros();
+
+  for (unsigned int i = 0; i < NUM_FRAMES; i++) {
+    CANFrame frame = makeFrame(3, ((i / 64) % 2) ? OPC_ACOF : OPC_ACON, 300, i % 64 + 1);
+    cbus.inject(&frame);
+    cbus.process();
+
+    if (i % 10 == 0 && cbus.getNextEvent(&event)) {
+      ++delivered;
+      last_state[event.index % 64] = event.is_on ? 1 : 2;
+    }
+  }
+
+  // the application catches up, and should see the final state of every event
+  while (cbus.getNextEvent(&event)) {
+    ++delivered;
+    last_state[event.index % 64] = event.is_on ? 1 : 2;
+  }
+
+  unsigned long elapsed = micros() - start;
+  printf("%-32s %8u frames %10.1f ns/frame %8u delivered %8u coalesced %8u dropped %8u final on\n", "event flood, deferred queue",
+         NUM_FRAMES, (elapsed * 1000.0) / NUM_FRAMES, delivered, cbus._numEventsCoalesced, cbus._numEventsDropped,
+         (unsigned int)std::count(last_state, last_state + 64, 1));
+
+  cbus.setEventQueue(nullptr, 0);
+}
+
+//
+/// accessory events processed in runs limited by a time budget, measured on the real clock
+//
+
+static void benchTimeBudget(CBUSHost &cbus) {
+
+  static const unsigned long BUDGET_US = 50;
+
+  for (unsigned int i = 0; i < NUM_FRAMES; i++) {
+    CANFrame frame = makeFrame(3, OPC_ACON, 400 + (i % 50), i % 1000);
+    cbus.inject(&frame);
+  }
+
+  VirtualClock::uninstall();
+
+  process_result_t result;
+  unsigned int runs = 0;
+  unsigned long max_elapsed = 0;
+
+  do {
+    cbus.processFor(BUDGET_US, &result);
+    ++runs;
+
+    if (result.elapsed_us > max_elapsed) {
+      max_elapsed = result.elapsed_us;
+    }
+  } while (result.frames_pending > 0);
+
+  VirtualClock::install();
+
+  printf("%-32s %8u frames %10.1f frames/run %8lu us max run\n", "accessory events, 50 us budget", NUM_FRAMES,
+         (double)NUM_FRAMES / runs, max_elapsed);
+}
+
+//
+/// traffic addressed to other nodes
+//
+
+static void benchForeignConfig(CBUSHost &cbus) {
+
+  static const byte opcodes[] = { OPC_RQNPN, OPC_NVRD, OPC_RQEVN, OPC_NNEVN, OPC_REVAL };
+
+  for (unsigned int i = 0; i < NUM_FRAMES; i++) {
+    CANFrame frame = makeFrame(3, opcodes[i % sizeof(opcodes)], 500 + (i % 10), 1, 5);
+    cbus.inject(&frame);
+  }
+
+  runFrames(cbus, "config requests, other nodes", NUM_FRAMES);
+}
+
+//
+/// traffic addressed to this node
+//
+
+static void benchOwnConfig(CBUSHost &cbus) {
+
+  unsigned int num_frames = NUM_FRAMES / 10;
+
+  for (unsigned int i = 0; i < num_frames; i++) {
+    CANFrame frame = makeFrame(3, (i % 2) ? OPC_RQNPN : OPC_NVRD, MY_NN, 0, 4);
+    frame.data[3] = 1 + (i % 8);
+    cbus.inject(&frame);
+  }
+
+  runFrames(cbus, "config requests, this node", num_frames);
+}
+
+//
+/// event table queries answered from the occupancy map
+//
+
+static void benchEventCounts(CBUSHost &cbus) {
+
+  unsigned int num_frames = NUM_FRAMES / 10;
+
+  for (unsigned int i = 0; i < num_frames; i++) {
+    CANFrame frame = makeFrame(3, (i % 2) ? OPC_RQEVN : OPC_NNEVN, MY_NN, 0, 3);
+    cbus.inject(&frame);
+  }
+
+  runFrames(cbus, "event counts, this node", num_frames);
+}
+
+//
+/// config requests arriving faster than the bus can carry the replies
+/// the simulated controller holds one frame, and the bus takes one frame per cycle, so replies to a burst must wait
+//
+
+static void benchTxBackPressure(CBUSHost &cbus) {
+
+  static const unsigned int NUM_REQUESTS = 1000;
+  unsigned int received = 0, cycles = 0;
+  CANFrame frame;
+
+  cbus.setTxCapacity(1);
+  cbus._numMsgsQueued = cbus._numMsgsDropped = 0;
+
+  for (unsigned int i = 0; i < NUM_REQUESTS || cbus.txQueueCount() > 0 || cbus.sentCount() > 0; cycles++) {
+    // a burst of three requests every fourth cycle
+    for (byte j = 0; j < 3 && i < NUM_REQUESTS && (cycles % 4) == 0; j++, i++) {
+      frame = makeFrame(3, OPC_RQNPN, MY_NN, 0, 4);
+      frame.data[3] = 1 + (i % 8);
+      cbus.inject(&frame);
+    }
+
+    cbus.process();
+
+    if (cbus.getSentMessage(&frame)) {
+      ++received;
+    }
+  }
+
+  printf("%-32s %8u requests %8u replies %8u queued %8u dropped\n", "config replies, busy bus", NUM_REQUESTS, received,
+         cbus._numMsgsQueued, cbus._numMsgsDropped);
+
+  cbus.setTxCapacity(0);
+}
+
+//
+/// a low priority frame queued behind a continuous stream of higher priority frames
+/// the bus takes one frame per simulated millisecond, and a new high priority frame is queued each millisecond
+/// reports the wait before the low priority frame is sent, or the cycle limit if it never is
+//
+
+static unsigned int runEscalation(CBUSHost &cbus) {
+
+  static const unsigned int MAX_CYCLES = 1000;
+  CANFrame frame;
+  unsigned int cycles;
+
+  cbus.setTxCapacity(1);
+
+  frame = makeFrame(3, OPC_ACON, MY_NN, 1, 5);
+  cbus.sendMessage(&frame, false, false, 0x7);              // fill the controller
+  cbus.queueMessage(&frame, false, false, 0x7);
+  frame = makeFrame(3, OPC_ACOF, MY_NN, 1, 5);
+  cbus.queueMessage(&frame);
+
+  for (cycles = 0; cycles < MAX_CYCLES; cycles++) {
+    frame = makeFrame(3, OPC_ACON, MY_NN, 1, 5);
+    cbus.queueMessage(&frame, false, false, 0x7);
+
+    VirtualClock::advanceMillis(1);
+    cbus.getSentMessage(&frame);
+
+    if (frame.data[0] == OPC_ACOF) {
+      break;
+    }
+
+    cbus.process();
+  }
+
+  // let the queue empty
+  while (cbus.txQueueCount() > 0) {
+    cbus.clearSent();
+    cbus.process();
+  }
+
+  cbus.clearSent();
+  cbus.setTxCapacity(0);
+  return cycles;
+}
+
+static void benchEscalation(CBUSHost &cbus) {
+
+  unsigned int plain = runEscalation(cbus);
+
+  cbus.setPriorityEscalation(5);
+  unsigned int escalated = runEscalation(cbus);
+  cbus.setPriorityEscalation(0);
+
+  printf("%-32s %8u ms without escalation %8u ms with\n", "low priority frame, busy bus", plain, escalated);
+}
+
+//
+/// a module consuming the events it sends, with a CBUScoe buffer and with loopback
+//
+
+static void runOwnEvents(CBUSHost &cbus, const char *name, CBUScoe *coe) {
+
+  static const unsigned int NUM_EVENTS = 100000;
+
+  events_consumed = 0;
+  unsigned long start = micros();
+
+  for (unsigned int i = 0; i < NUM_EVENTS; i++) {
+    CANFrame frame = makeFrame(3, (i % 2) ? OPC_ACOF : OPC_ACON, 300, i % 64 + 1);
+    if (coe != nullptr) {
+      coe->put(&frame);
+    }
+
+    cbus.queueMessage(&frame);
+
+    cbus.process();
+    cbus.clearSent();
+  }
+
+  unsigned long elapsed = micros() - start;
+  printf("%-32s %8u events %10.1f ns/event %8lu consumed\n", name, NUM_EVENTS, (elapsed * 1000.0) / NUM_EVENTS, events_consumed);
+}
+
+static void benchOwnEvents(CBUSHost &cbus) {
+
+  CBUScoe coe;
+  static CANFrame loopback[4];
+
+  cbus.consumeOwnEvents(&coe);
+  runOwnEvents(cbus, "own events, CBUScoe", &coe);
+  cbus.consumeOwnEvents(nullptr);
+
+  cbus.setLoopback(LOOPBACK_EVENTS, loopback, 4);
+  runOwnEvents(cbus, "own events, loopback", nullptr);
+  cbus.setLoopback(LOOPBACK_OFF);
+}
+
+//
+/// a module producing 64 events at power-up, then one input chattering, with a rate limit of bursts of 8 then
+/// one event every 5 ms, on simulated time
+//
+
+static void benchProducer(CBUSHost &cbus) {
+
+  static produced_event_t queue[64];
+  unsigned int sent = 0, max_in_window = 0, in_window = 0;
+  unsigned long vstart = VirtualClock::millis();
+  CANFrame frame;
+
+  cbus.setEventProducer(queue, 64);
+  cbus.setEventRateLimit(8, 5);
+  cbus._numProducedEvents = cbus._numProducedCoalesced = cbus._numProducedDropped = 0;
+  cbus.clearSent();
+
+  for (unsigned int en = 1; en <= 64; en++) {
+    cbus.sendEvent(en, true);
+  }
+
+  for (unsigned int ms = 0; ms < 1000; ms++) {
+    if (ms < 100) {
+      byte data = (byte)ms;
+      cbus.sendEvent(100, ms % 2, false, &data, 1);
+    }
+
+    cbus.process();
+
+    while (cbus.getSentMessage(&frame)) {
+      ++sent;
+      ++in_window;
+    }
+
+    if (ms % 50 == 49) {
+      max_in_window = (in_window > max_in_window) ? in_window : max_in_window;
+      in_window = 0;
+    }
+
+    VirtualClock::advanceMillis(1);
+  }
+
+  printf("%-32s %8u sent %8u coalesced %8u dropped %8u max per 50 ms %8lu simulated ms\n", "event producer, rate limited", sent,
+         cbus._numProducedCoalesced, cbus._numProducedDropped, max_in_window, VirtualClock::millis() - vstart);
+
+  cbus.setEventRateLimit(0, 0);
+  cbus.setEventProducer(nullptr, 0);
+}
+
+//
+/// start of day status queries for 64 produced events, half long and half short, answered from the produced event states
+//
+
+static void benchEventStateQueries(CBUSHost &cbus) {
+
+  static byte states[PRODUCED_STATE_BYTES(64)];
+  unsigned int num_frames = NUM_FRAMES / 10, replies = 0, on = 0;
+  CANFrame frame;
+
+  cbus.setProducedEventStates(states, 1, 64);
+
+  for (unsigned int en = 1; en <= 64; en++) {
+    cbus.sendEvent(en, en % 3 == 0, en > 32);
+  }
+
+  cbus.clearSent();
+  unsigned long start = micros();
+
+  for (unsigned int i = 0; i < num_frames; i++) {
+    unsigned int en = i % 64 + 1;
+    frame = makeFrame(3, (en > 32) ? OPC_ASRQ : OPC_AREQ, MY_NN, en, 5);
+    cbus.inject(&frame);
+    cbus.process();
+
+    while (cbus.getSentMessage(&frame)) {
+      ++replies;
+      on += (frame.data[0] == OPC_ARON || frame.data[0] == OPC_ARSON);
+    }
+  }
+
+  unsigned long elapsed = micros() - start;
+  printf("%-32s %8u frames %10.1f ns/frame %8u replies %8u on\n", "AREQ/ASRQ, produced states", num_frames,
+         (elapsed * 1000.0) / num_frames, replies, on);
+
+  cbus.setProducedEventStates(nullptr, 0, 0);
+}
+
+//
+/// 16 debounced inputs, each changing every 200 scans with 3 scans of contact bounce, producing events for the changes
+//
+
+static void benchInputScan(CBUSHost &cbus) {
+
+  static const unsigned int NUM_SCANS = 100000;
+  byte upper_pins[8] = {2, 3, 4, 5, 6, 7, 8, 9};
+  byte lower_pins[8] = {10, 11, 12, 13, 14, 15, 16, 255};
+  BoardIOPinSet upper(upper_pins), lower(lower_pins);
+  unsigned int changes = 0, sent = 0;
+  CANFrame frame;
+
+  upper.beginInputs();
+  lower.beginInputs();
+  cbus.clearSent();
+
+  unsigned long start = micros();
+
+  for (unsigned int scan = 0; scan < NUM_SCANS; scan++) {
+    for (byte pin = 2; pin <= 16; pin++) {
+      unsigned int phase = (scan + pin * 13) % 200;
+      bool level = ((scan + pin * 13) / 200) % 2;
+      setSimulatedPin(pin, (phase < 3) ? (phase % 2 == 0) != level : level);
+    }
+
+    changes += __builtin_popcount(upper.scanAndSend(cbus, 1));
+    changes += __builtin_popcount(lower.scanAndSend(cbus, 9));
+
+    while (cbus.getSentMessage(&frame)) {
+      ++sent;
+    }
+  }
+
+  unsigned long elapsed = micros() - start;
+  printf("%-32s %8u scans %10.1f ns/scan %8u changes %8u sent\n", "15 inputs, debounced", NUM_SCANS, (elapsed * 1000.0) / NUM_SCANS,
+         changes, sent);
+}
+
+//
+/// frame buffers, put and get in a single thread, then a producer thread feeding a consumer
+//
+
+static void benchBuffers(void) {
+
+  static const unsigned int NUM_PUTS = 1000000;
+  CANFrame frame = makeFrame(3, OPC_ACON, 300, 1);
+  CANFrame out;
+  unsigned long start, elapsed;
+
+  circular_buffer2 cb2(64);
+  start = micros();
+
+  for (unsigned int i = 0; i < NUM_PUTS; i++) {
+    cb2.put(&frame);
+    out = *cb2.get();
+  }
+
+  elapsed = micros() - start;
+  printf("%-32s %8u puts %10.1f ns/put+get\n", "circular_buffer2", NUM_PUTS, (elapsed * 1000.0) / NUM_PUTS);
+
+  static circular_buffer_static<CANFrame, 1024> cbs;
+  start = micros();
+
+  for (unsigned int i = 0; i < NUM_PUTS; i++) {
+    cbs.put(&frame);
+    out = *cbs.get();
+  }
+
+  elapsed = micros() - start;
+  printf("%-32s %8u puts %10.1f ns/put+get\n", "circular_buffer_static", NUM_PUTS, (elapsed * 1000.0) / NUM_PUTS);
+
+  static circular_buffer_spsc<CANFrame, 64> spsc;
+  start = micros();
+
+  for (unsigned int i = 0; i < NUM_PUTS; i++) {
+    spsc.put(&frame);
+    spsc.get(&out);
+  }
+
+  elapsed = micros() - start;
+  printf("%-32s %8u puts %10.1f ns/put+get\n", "circular_buffer_spsc", NUM_PUTS, (elapsed * 1000.0) / NUM_PUTS);
+
+  // the producer numbers its frames, and the consumer checks that none are lost or reordered
+  unsigned int errors = 0, expected = 0;
+  spsc.clear();
+
+  std::thread producer([&frame]() {
+    CANFrame f = frame;
+
+    for (unsigned int i = 0; i < NUM_PUTS; i++) {
+      memcpy(&f.data[4], &i, sizeof(i));
+
+      while (!spsc.put(&f)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  while (expected < NUM_PUTS) {
+    CANFrame *p = spsc.peek();
+
+    if (p != nullptr) {
+      unsigned int seq;
+      memcpy(&seq, &p->data[4], sizeof(seq));
+      errors += (seq != expected);
+      ++expected;
+      spsc.pop();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  producer.join();
+  printf("%-32s %8u frames %8u errors %8u overflows %8u hwm\n", "circular_buffer_spsc, 2 threads", expected, errors,
+         spsc.overflows(), spsc.hwm());
+}
+
+//
+/// a long message transfer between two connected nodes
+//
+
+static void longmessagehandler(void *msg, unsigned int msg_len, byte stream_id, byte status) {
+
+  (void)msg;
+  (void)stream_id;
+  printf("%-32s %8u bytes received, status = %u\n", "", msg_len, status);
+}
+
+static bool long_message_sent = false;
+
+static void longmessagesent(const void *msg, unsigned int msg_len, byte stream_id, byte status) {
+
+  (void)msg;
+  (void)msg_len;
+  (void)stream_id;
+  long_message_sent = (status == CBUS_LONG_MESSAGE_COMPLETE);
+}
+
+static void benchLongMessage(CBUSHost &sender, CBUSHost &receiver, bool copy) {
+
+  static byte stream_ids[] = { 1 };
+  static byte message[256];
+  static byte receive_arena[LONG_MESSAGE_ARENA_BYTES(NUM_EX_CONTEXTS, sizeof(message), 1, EX_BUFFER_LEN)];
+
+  CBUSLongMessageEx lmsg_send(&sender);
+  CBUSLongMessageEx lmsg_receive(&receiver);
+
+  lmsg_send.allocateContextsBuffers(1, 32, NUM_EX_CONTEXTS, sizeof(message));
+  lmsg_receive.allocateContexts(NUM_EX_CONTEXTS, sizeof(message), 1, receive_arena, sizeof(receive_arena));
+  lmsg_receive.subscribe(stream_ids, sizeof(stream_ids), longmessagehandler);
+  lmsg_send.use_crc(true);
+  lmsg_receive.use_crc(true);
+
+  // a binary message, including zero bytes
+  for (unsigned int i = 0; i < sizeof(message); i++) {
+    message[i] = i;
+  }
+
+  long_message_sent = false;
+
+  if (copy) {
+    lmsg_send.sendLongMessage(message, sizeof(message), 1);
+  } else {
+    lmsg_send.sendLongMessageNoCopy(message, sizeof(message), 1, DEFAULT_PRIORITY, longmessagesent);
+  }
+
+  unsigned long start = micros();
+  unsigned long vstart = VirtualClock::millis();
+
+  while (lmsg_send.is_sending()) {
+    lmsg_send.process();
+    receiver.process();
+    lmsg_receive.process();
+    VirtualClock::advanceMillis(1);
+  }
+
+  while (receiver.pendingMessages() > 0) {
+    receiver.process();
+  }
+
+  unsigned long elapsed = micros() - start;
+
+  printf("%-32s %8u bytes %10lu us %8lu simulated ms %s\n", copy ? "long message, 256 bytes" : "long message, no copy", (unsigned int)sizeof(message), elapsed,
+         VirtualClock::millis() - vstart, long_message_sent ? "sent" : "");
+}
+
+//
+/// a sequence of long messages, each sent from the send handler of the one before, as when uploading a configuration
+//
+
+static unsigned long long_messages_received = 0;
+
+static void countLongMessage(void *msg, unsigned int msg_len, byte stream_id, byte status) {
+
+  (void)msg;
+  (void)msg_len;
+  (void)stream_id;
+
+  if (status == CBUS_LONG_MESSAGE_COMPLETE) {
+    ++long_messages_received;
+  }
+}
+
+static const unsigned int NUM_CHAINED_MESSAGES = 8;
+static CBUSLongMessageEx *chain_sender = nullptr;
+static unsigned int chained_messages_sent = 0;
+
+static void sendNextChained(const void *msg, unsigned int bytes_sent, byte stream_id, byte status) {
+
+  if (status == CBUS_LONG_MESSAGE_COMPLETE && ++chained_messages_sent < NUM_CHAINED_MESSAGES) {
+    chain_sender->sendLongMessage(msg, bytes_sent, stream_id, DEFAULT_PRIORITY, sendNextChained);
+  }
+}
+
+static void benchChainedMessages(CBUSHost &sender, CBUSHost &receiver) {
+
+  static byte stream_ids[] = { 1 };
+  static byte message[64];
+
+  CBUSLongMessageEx lmsg_send(&sender);
+  CBUSLongMessageEx lmsg_receive(&receiver);
+
+  lmsg_send.allocateContextsBuffers(1, 32, 1, sizeof(message));
+  lmsg_receive.allocateContexts(1, sizeof(message), 1);
+  lmsg_receive.subscribe(stream_ids, sizeof(stream_ids), countLongMessage);
+  chain_sender = &lmsg_send;
+  chained_messages_sent = 0;
+  long_messages_received = 0;
+
+  unsigned long start = micros();
+  unsigned long vstart = VirtualClock::millis();
+
+  lmsg_send.sendLongMessage(message, sizeof(message), 1, DEFAULT_PRIORITY, sendNextChained);
+
+  while (lmsg_send.is_sending()) {
+    lmsg_send.process();
+    receiver.process();
+    lmsg_receive.process();
+    VirtualClock::advanceMillis(1);
+  }
+
+  while (receiver.pendingMessages() > 0) {
+    receiver.process();
+  }
+
+  unsigned long elapsed = micros() - start;
+
+  printf("%-32s %8u msgs %10lu us %8lu simulated ms %8lu received\n", "long messages, chained", chained_messages_sent, elapsed,
+         VirtualClock::millis() - vstart, long_messages_received);
+}
+
+//
+/// interleaved long messages from many senders, with the fragments delivered straight to the receiver
+/// the cost per fragment should not grow with the number of receive contexts
+//
+
+static void benchReceiveContexts(CBUSHost &receiver, byte num_contexts) {
+
+  static const unsigned int NUM_FRAGMENTS = 50;
+  static const unsigned int NUM_ROUNDS = 200;
+  static byte stream_ids[] = { 1, 2, 3, 4 };
+  CANFrame frame{};
+  char name[40];
+
+  CBUSLongMessageEx lmsg_receive(&receiver);
+  lmsg_receive.allocateContexts(num_contexts, NUM_FRAGMENTS * 5, 1);
+  lmsg_receive.subscribe(stream_ids, sizeof(stream_ids), countLongMessage);
+
+  frame.len = 8;
+  frame.data[0] = OPC_DTXC;
+  long_messages_received = 0;
+
+  unsigned long start = micros();
+
+  for (unsigned int round = 0; round < NUM_ROUNDS; round++) {
+    for (unsigned int seq = 0; seq <= NUM_FRAGMENTS; seq++) {
+      for (byte sender = 0; sender < num_contexts; sender++) {
+        frame.id = 10 + sender;
+        frame.data[1] = stream_ids[sender % sizeof(stream_ids)];
+        frame.data[2] = seq;
+
+        if (seq == 0) {
+          frame.data[3] = highByte(NUM_FRAGMENTS * 5);
+          frame.data[4] = lowByte(NUM_FRAGMENTS * 5);
+          memset(&frame.data[5], 0, 3);
+        } else {
+          memset(&frame.data[3], seq, 5);
+        }
+
+        lmsg_receive.processReceivedMessageFragment(&frame);
+      }
+    }
+  }
+
+  unsigned long elapsed = micros() - start;
+  unsigned long num_fragments = (unsigned long)NUM_ROUNDS * (NUM_FRAGMENTS + 1) * num_contexts;
+
+  snprintf(name, sizeof(name), "long message, %u contexts", num_contexts);
+  printf("%-32s %8lu frags %10.2f ns/frag %8lu received\n", name, num_fragments, (elapsed * 1000.0) / num_fragments, long_messages_received);
+}
+
+//
+/// CRC16 of a long message buffer
+//
+
+static void benchCRC(void) {
+
+  static byte buffer[1024];
+  static const unsigned int NUM_RUNS = 1000;
+  uint16_t crc = 0;
+
+  for (unsigned int i = 0; i < sizeof(buffer); i++) {
+    buffer[i] = (byte)(i * 7);
+  }
+
+  unsigned long start = micros();
+
+  for (unsigned int i = 0; i < NUM_RUNS; i++) {
+    buffer[0] = (byte)i;
+    crc += crc16(buffer, sizeof(buffer));
+  }
+
+  unsigned long elapsed = micros() - start;
+  printf("%-32s %8u bytes %10.2f ns/byte %8x sum\n", "CRC16", (unsigned int)sizeof(buffer), (elapsed * 1000.0) / (NUM_RUNS * sizeof(buffer)), crc);
+}
+
+//
+/// read the event table with NERD while accessory events continue to arrive
+//
+
+static void benchNERD(CBUSHost &cbus) {
+
+  events_consumed = 0;
+
+  CANFrame frame = makeFrame(2, OPC_NERD, MY_NN, 0, 3);
+  cbus.inject(&frame);
+  cbus.process();
+
+  unsigned long start = micros();
+  unsigned long vstart = VirtualClock::millis();
+
+  while (cbus.isResponding()) {
+    frame = makeFrame(3, OPC_ACON, 300, (VirtualClock::millis() % 64) + 1);
+    cbus.inject(&frame);
+    cbus.process();
+    VirtualClock::advanceMillis(1);
+  }
+
+  unsigned long elapsed = micros() - start;
+
+  printf("%-32s %8u sent %10lu us %8lu simulated ms %8lu events meanwhile\n", "NERD, 64 events", cbus.sentCount(), elapsed,
+         VirtualClock::millis() - vstart, events_consumed);
+
+  cbus.clearSent();
+}
+
+//
+/// CAN ID enumeration cycles, each answered by many other nodes
+//
+
+static void benchEnumeration(CBUSHost &cbus) {
+
+  static const unsigned int NUM_CYCLES = 1000;
+  static const byte NUM_RESPONDERS = 60;
+
+  unsigned long start = micros();
+
+  for (unsigned int i = 0; i < NUM_CYCLES; i++) {
+    CANFrame frame = makeFrame(2, OPC_ENUM, MY_NN, 0, 3);
+    cbus.inject(&frame);
+    cbus.process();
+
+    for (byte id = 1; id <= NUM_RESPONDERS; id++) {
+      frame = makeFrame(id, 0, 0, 0, 0);
+      cbus.inject(&frame);
+    }
+
+    while (cbus.pendingMessages() > 0) {
+      cbus.process(255);
+    }
+
+    VirtualClock::advanceMillis(100);
+    cbus.process();
+  }
+
+  unsigned long elapsed = micros() - start;
+
+  printf("%-32s %8u cycles %10.1f us/cycle %8u sent, CANID = %u\n", "enumeration, 60 responders", NUM_CYCLES,
+         (double)elapsed / NUM_CYCLES, cbus.sentCount(), config.CANID);
+
+  cbus.clearSent();
+}
+
+int main(void) {
+
+  VirtualClock::install();
+
+  config.EE_NVS_START = 10;
+  config.EE_NUM_NVS = 8;
+  config.EE_MAX_EVENTS = 128;
+  config.EE_NUM_EVS = 2;
+  config.begin();
+
+  CBUSParams params(config);
+  params.setVersion(1, 0, 0);
+  params.setModuleId(99);
+  params.setFlags(PF_FLiM | PF_COMBI);
+
+  static unsigned char mname[7] = { 'B', 'E', 'N', 'C', 'H', ' ', ' ' };
+
+  static CANFrame rx_batch[4];
+
+  CBUSHost cbus(&config);
+  cbus.setReceiveBatch(rx_batch, 4);
+  cbus.setParams(params.getParams());
+  cbus.setName(mname);
+  cbus.setEventHandler(eventhandler);
+  cbus.begin();
+
+  config.setNodeNum(MY_NN);
+  config.setFLiM(true);
+  config.setCANID(1);
+
+  learnEvents(cbus, 64);
+
+  benchAccessoryEvents(cbus, "accessory events, 10% learned", 1000);
+  benchAccessoryEvents(cbus, "accessory events, uncached", 128);
+  benchEventCache(cbus);
+  benchEventFilter(cbus);
+  benchOpcodeHandlers(cbus);
+  benchEventQueue(cbus);
+  benchTimeBudget(cbus);
+  benchForeignConfig(cbus);
+  benchOwnConfig(cbus);
+  benchEventCounts(cbus);
+  benchTxBackPressure(cbus);
+  benchEscalation(cbus);
+  benchOwnEvents(cbus);
+  benchProducer(cbus);
+  benchEventStateQueries(cbus);
+  benchInputScan(cbus);
+  benchBuffers();
+  benchNERD(cbus);
+  benchEnumeration(cbus);
+
+  CBUSConfig receiver_config;
+  receiver_config.EE_MAX_EVENTS = 8;
+  receiver_config.begin();
+  receiver_config.setCANID(2);
+
+  CBUSHost receiver(&receiver_config);
+  receiver.begin();
+  cbus.connect(&receiver);
+  benchLongMessage(cbus, receiver, true);
+  benchLongMessage(cbus, receiver, false);
+  benchChainedMessages(cbus, receiver);
+  benchReceiveContexts(receiver, 4);
+  benchReceiveContexts(receiver, 8);
+  benchReceiveContexts(receiver, 16);
+  benchReceiveContexts(receiver, 32);
+  benchCRC();
+
+  return 0;
+}
@@ -0,0 +1,954 @@
+/*
+
+  Copyright (C) CBUS library contributors 2026
+
+  This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+//
+/// host tests for the CBUS library
+/// each test builds its own modules on the virtual clock and checks what the library does with them
+/// failed checks are reported and counted, and the count is the exit status seen by ctest
+//
+
+#include <stdio.h>
+#include <thread>
+
+#include <CBUSHost.h>
+#include <CBUSParams.h>
+#include <VirtualClock.h>
+
+// the module configuration used by the default CBUSbase constructor, as defined in a sketch
+
+CBUSConfig config;
+
+static unsigned int num_checks = 0, num_failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+static void check(bool ok, const char *expr, const char *file, int line) {
+
+  ++num_checks;
+
+  if (!ok) {
+    ++num_failures;
+    printf("%s:%d: check failed: %s\n", file, line, expr);
+  }
+}
+
+//
+/// a module with its own configuration and in-memory transport
+//
+
+class TestModule {
+
+public:
+  TestModule(unsigned int nn, byte canid, bool flim = true) : params(init(nn, canid, flim)), cbus(&cfg) {
+
+    cbus.setParams(params.getParams());
+    cbus.setName(mname);
+    cbus.begin();
+  }
+
+  CBUSConfig cfg;
+  CBUSParams params;
+  CBUSHost cbus;
+
+private:
+  CBUSConfig & init(unsigned int nn, byte canid, bool flim) {
+
+    cfg.EE_NVS_START = 10;
+    cfg.EE_NUM_NVS = 8;
+    cfg.EE_MAX_EVENTS = 32;
+    cfg.EE_NUM_EVS = 2;
+    cfg.begin();
+    cfg.setNodeNum(nn);
+    cfg.setFLiM(flim);
+    cfg.setCANID(canid);
+    return cfg;
+  }
+
+  unsigned char mname[7] = { 'T', 'E', 'S', 'T', ' ', ' ', ' ' };
+};
+
+//
+/// build a frame with the given opcode, node number and event number
+//
+
+static CANFrame makeFrame(byte canid, byte opc, unsigned int nn, unsigned int en, byte len = 5) {
+
+  CANFrame frame{};
+
+  frame.id = (DEFAULT_PRIORITY << 7) + canid;
+  frame.len = len;
+  frame.data[0] = opc;
+  frame.data[1] = highByte(nn);
+  frame.data[2] = lowByte(nn);
+  frame.data[3] = highByte(en);
+  frame.data[4] = lowByte(en);
+  return frame;
+}
+
+//
+/// process received frames and any timed activity until the module is idle
+//
+
+static void settle(CBUSHost &cbus, unsigned int max_ms = 1000) {
+
+  for (unsigned int i = 0; i < max_ms && (cbus.pendingMessages() > 0 || cbus.txQueueCount() > 0 || cbus.isResponding() || i < 2); i++) {
+    cbus.process(255);
+    VirtualClock::advanceMillis(1);
+  }
+}
+
+//
+/// take sent frames up to and including the first with this opcode
+//
+
+static bool findSent(CBUSHost &cbus, byte opc, CANFrame *found = nullptr) {
+
+  CANFrame frame;
+
+  while (cbus.getSentMessage(&frame)) {
+    if (frame.len > 0 && frame.data[0] == opc) {
+      if (found != nullptr) {
+        *found = frame;
+      }
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+//
+/// learn an event using the same opcodes as a configuration tool
+//
+
+static void learnEvent(TestModule &module, unsigned int nn, unsigned int en, byte ev1) {
+
+  CANFrame frame = makeFrame(2, OPC_NNLRN, module.cfg.nodeNum, 0, 3);
+  module.cbus.inject(&frame);
+
+  frame = makeFrame(2, OPC_EVLRN, nn, en, 7);
+  frame.data[5] = 1;
+  frame.data[6] = ev1;
+  module.cbus.inject(&frame);
+
+  frame = makeFrame(2, OPC_NNULN, module.cfg.nodeNum, 0, 3);
+  module.cbus.inject(&frame);
+
+  settle(module.cbus);
+  module.cbus.clearSent();
+}
+
+//
+/// consumed events
+//
+
+static unsigned int events_consumed = 0;
+static byte last_event_index = 0xff;
+static bool last_event_on = false;
+
+static void eventhandler(byte index, CANFrame *msg, bool ison, byte evval) {
+
+  (void)msg;
+  (void)evval;
+  ++events_consumed;
+  last_event_index = index;
+  last_event_on = ison;
+}
+
+//
+/// a virgin module is given a node number by a configuration tool
+//
+
+static void testFLiMSetup(void) {
+
+  TestModule module(0, 0, false);
+  CANFrame frame;
+
+  module.cbus.initFLiM();
+  settle(module.cbus);
+  CHECK(findSent(module.cbus, OPC_RQNN));
+
+  frame = makeFrame(2, OPC_SNN, 300, 0, 3);
+  module.cbus.inject(&frame);
+  settle(module.cbus);
+
+  CHECK(findSent(module.cbus, OPC_NNACK, &frame));
+  CHECK(module.cfg.FLiM);
+  CHECK(module.cfg.nodeNum == 300);
+}
+
+//
+/// a module that consumes its own events is still given a node number, and sees each event it sends once
+//
+
+static unsigned int frames_sent = 0;
+
+static void countSent(CANFrame *msg) {
+
+  (void)msg;
+  ++frames_sent;
+}
+
+static void testFLiMSetupLoopback(void) {
+
+  TestModule module(0, 0, false);
+  CANFrame frame, loopback[4];
+
+  module.cbus.setEventHandler(eventhandler);
+  module.cbus.setLoopback(LOOPBACK_EVENTS, loopback, 4);
+
+  module.cbus.initFLiM();
+  settle(module.cbus);
+  CHECK(findSent(module.cbus, OPC_RQNN));
+  CHECK(!findSent(module.cbus, OPC_NNACK));
+
+  frame = makeFrame(2, OPC_SNN, 300, 0, 3);
+  module.cbus.inject(&frame);
+  settle(module.cbus);
+
+  CHECK(findSent(module.cbus, OPC_NNACK));
+  CHECK(module.cfg.FLiM);
+  CHECK(module.cfg.nodeNum == 300);
+
+  learnEvent(module, 300, 9, 1);
+  module.cbus.setTransmitHandler(countSent);
+  events_consumed = 0;
+  frames_sent = 0;
+  CHECK(module.cbus.sendEvent(9, true));
+  settle(module.cbus);
+  CHECK(events_consumed == 1);
+  CHECK(last_event_on);
+  CHECK(frames_sent == 1);
+
+  // an event held in the transmit queue is looped back once it has been sent
+  module.cbus.clearSent();
+  module.cbus.setTxCapacity(1);
+  frame = makeFrame(1, OPC_WRACK, 300, 0, 3);
+  CHECK(module.cbus.queueMessage(&frame));
+  CHECK(module.cbus.sendEvent(9, false));
+  CHECK(module.cbus.txQueueCount() == 1);
+  module.cbus.process();
+  CHECK(events_consumed == 1);
+
+  module.cbus.clearSent();
+  settle(module.cbus);
+  CHECK(events_consumed == 2);
+  CHECK(!last_event_on);
+  CHECK(frames_sent == 3);
+
+  module.cbus.setTxCapacity(0);
+  module.cbus.setTransmitHandler(nullptr);
+  module.cbus.setLoopback(LOOPBACK_OFF);
+}
+
+//
+/// a learned event reaches the event handler, and an unknown event does not
+//
+
+static void testAccessoryEvents(void) {
+
+  TestModule module(256, 1);
+  module.cbus.setEventHandler(eventhandler);
+  learnEvent(module, 300, 7, 1);
+
+  events_consumed = 0;
+  CANFrame frame = makeFrame(3, OPC_ACON, 300, 7);
+  module.cbus.inject(&frame);
+  frame = makeFrame(3, OPC_ACOF, 300, 8);
+  module.cbus.inject(&frame);
+  settle(module.cbus);
+
+  CHECK(events_consumed == 1);
+  CHECK(last_event_index == 0);
+  CHECK(last_event_on);
+}
+
+//
+/// the event pre-filter, sized to the event table, passes every learned event and rejects most others
+//
+
+static void testEventFilter(void) {
+
+  TestModule module(256, 1);
+  static byte filter[EVENT_FILTER_BYTES(32)];
+
+  CHECK(EVENT_FILTER_BYTES(1) == 8 && EVENT_FILTER_BYTES(32) == 32 && EVENT_FILTER_BYTES(255) == 256);
+
+  module.cbus.setEventHandler(eventhandler);
+  module.cbus.setEventFilter(filter, sizeof(filter));
+  module.cbus._numEventFilterRejects = 0;
+
+  for (unsigned int en = 1; en <= 32; en++) {
+    learnEvent(module, 300, en, 1);
+  }
+
+  events_consumed = 0;
+
+  for (unsigned int en = 1; en <= 1000; en++) {
+    CANFrame frame = makeFrame(3, OPC_ACON, (en <= 32) ? 300 : 400 + en % 50, en);
+    module.cbus.inject(&frame);
+  }
+
+  settle(module.cbus);
+  CHECK(events_consumed == 32);
+  CHECK(module.cbus._numEventFilterRejects > 900);
+
+  module.cbus.setEventFilter(nullptr, 0);
+}
+
+//
+/// a module consumes its own events from a static CBUScoe buffer of more than 255 entries
+/// frames injected beyond the receive buffer wait on the bus rather than being lost
+//
+
+static void testOwnEvents(void) {
+
+  TestModule module(256, 1);
+  static CBUScoeBuffer<300> coe;
+
+  module.cbus.setEventHandler(eventhandler);
+  module.cbus.consumeOwnEvents(&coe);
+  learnEvent(module, 300, 7, 1);
+
+  CANFrame frame = makeFrame(3, OPC_ACON, 300, 7);
+
+  for (unsigned int i = 0; i < 300; i++) {
+    coe.put(&frame);
+  }
+
+  CHECK(coe.size() == 300);
+  coe.put(&frame);
+  CHECK(coe.size() == 300);
+
+  events_consumed = 0;
+  settle(module.cbus);
+  CHECK(events_consumed == 300);
+  CHECK(!coe.available());
+  module.cbus.consumeOwnEvents(nullptr);
+
+  for (unsigned int i = 0; i < HOST_RX_BUFFER_SIZE + 10; i++) {
+    module.cbus.inject(&frame);
+  }
+
+  CHECK(module.cbus.pendingMessages() == HOST_RX_BUFFER_SIZE);
+  events_consumed = 0;
+  settle(module.cbus);
+  CHECK(events_consumed == HOST_RX_BUFFER_SIZE + 10);
+}
+
+//
+/// queued events are coalesced to their latest state, with or without the pending bit map
+//
+
+static void testEventQueue(void) {
+
+  TestModule module(256, 1);
+  consumed_event_t queue[4], event;
+  byte pending[EVENT_QUEUE_PENDING_BYTES(32)];
+
+  learnEvent(module, 300, 7, 1);
+  learnEvent(module, 300, 8, 2);
+
+  for (byte pass = 0; pass < 2; pass++) {
+    module.cbus.setEventQueue(queue, 4, (pass == 0) ? pending : nullptr, sizeof(pending));
+    module.cbus._numEventsCoalesced = 0;
+
+    CANFrame frame = makeFrame(3, OPC_ACON, 300, 7);
+    module.cbus.inject(&frame);
+    frame = makeFrame(3, OPC_ACON, 300, 8);
+    module.cbus.inject(&frame);
+    frame = makeFrame(3, OPC_ACOF, 300, 7);
+    module.cbus.inject(&frame);
+    settle(module.cbus);
+
+    CHECK(module.cbus.eventQueueCount() == 2);
+    CHECK(module.cbus._numEventsCoalesced == 1);
+    CHECK(module.cbus.getNextEvent(&event) && event.index == 0 && !event.is_on && event.ev1 == 1);
+    CHECK(module.cbus.getNextEvent(&event) && event.index == 1 && event.is_on && event.ev1 == 2);
+    CHECK(!module.cbus.getNextEvent(&event));
+
+    // once taken, an event is queued again rather than coalesced
+    frame = makeFrame(3, OPC_ACON, 300, 7);
+    module.cbus.inject(&frame);
+    settle(module.cbus);
+    CHECK(module.cbus.eventQueueCount() == 1);
+    CHECK(module.cbus._numEventsCoalesced == 1);
+    CHECK(module.cbus.getNextEvent(&event) && event.index == 0 && event.is_on);
+  }
+
+  module.cbus.setEventQueue(nullptr, 0);
+}
+
+//
+/// opcode handlers receive standard data frames for their opcodes, with their own context
+//
+
+static void countFrame(CANFrame *msg, void *context) {
+
+  (void)msg;
+  ++*(unsigned int *)context;
+}
+
+// a handler that removes itself on its first call
+
+static unsigned int one_shot_frames = 0;
+
+static void oneShotFrame(CANFrame *msg, void *context) {
+
+  (void)msg;
+  ++one_shot_frames;
+  ((TestModule *)context)->cbus.removeOpcodeHandler(oneShotFrame, context);
+}
+
+static void testOpcodeHandlers(void) {
+
+  TestModule module(256, 1);
+  unsigned int on_frames = 0, range_frames = 0;
+  CANFrame frame;
+
+  CHECK(module.cbus.addOpcodeHandler(OPC_ACON, countFrame, &on_frames));
+  CHECK(module.cbus.addOpcodeHandler(OPC_ACON, OPC_ACOF, countFrame, &range_frames));
+
+  frame = makeFrame(3, OPC_ACON, 300, 7);
+  module.cbus.inject(&frame);
+  frame = makeFrame(3, OPC_ACOF, 300, 7);
+  module.cbus.inject(&frame);
+  frame = makeFrame(3, OPC_ASON, 0, 7);
+  module.cbus.inject(&frame);
+
+  // extended and RTR frames are not passed to the handlers, whatever their first data byte
+  frame = makeFrame(3, OPC_ACON, 300, 7);
+  frame.ext = true;
+  module.cbus.inject(&frame);
+  frame = makeFrame(3, OPC_ACON, 300, 7);
+  frame.rtr = true;
+  module.cbus.inject(&frame);
+
+  settle(module.cbus);
+  CHECK(on_frames == 1);
+  CHECK(range_frames == 2);
+
+  module.cbus.removeOpcodeHandler(countFrame, &on_frames);
+  frame = makeFrame(3, OPC_ACON, 300, 7);
+  module.cbus.inject(&frame);
+  settle(module.cbus);
+  CHECK(on_frames == 1);
+  CHECK(range_frames == 3);
+
+  module.cbus.removeOpcodeHandler(countFrame, &range_frames);
+
+  // a handler removing itself from its callback does not stop the handlers after it being called for that frame
+  CHECK(module.cbus.addOpcodeHandler(OPC_ACON, oneShotFrame, &module));
+  CHECK(module.cbus.addOpcodeHandler(OPC_ACON, countFrame, &on_frames));
+
+  for (byte i = 0; i < 2; i++) {
+    frame = makeFrame(3, OPC_ACON, 300, 7);
+    module.cbus.inject(&frame);
+  }
+
+  settle(module.cbus);
+  CHECK(one_shot_frames == 1);
+  CHECK(on_frames == 3);
+
+  module.cbus.removeOpcodeHandler(countFrame, &on_frames);
+}
+
+//
+/// frames received in batches are all processed, and process(n) handles no more than n frames
+//
+
+static void testReceiveBatch(void) {
+
+  TestModule module(256, 1);
+  CANFrame rx_batch[4];
+
+  module.cbus.setEventHandler(eventhandler);
+  module.cbus.setReceiveBatch(rx_batch, 4);
+  learnEvent(module, 300, 7, 1);
+
+  events_consumed = 0;
+
+  for (byte i = 0; i < 10; i++) {
+    CANFrame frame = makeFrame(3, (i % 2) ? OPC_ACOF : OPC_ACON, 300, 7);
+    module.cbus.inject(&frame);
+  }
+
+  module.cbus.process(3);
+  CHECK(events_consumed == 3);
+  CHECK(module.cbus.pendingMessages() == 7);
+
+  settle(module.cbus);
+  CHECK(events_consumed == 10);
+  CHECK(!last_event_on);
+
+  module.cbus.setReceiveBatch(nullptr, 0);
+}
+
+//
+/// frames put into the receive buffer from another thread, as from a receive interrupt, are all processed once
+//
+
+static void testReceiveThread(void) {
+
+  static const unsigned int NUM_FRAMES = 20000;
+  TestModule module(256, 1);
+
+  module.cbus.setEventHandler(eventhandler);
+  learnEvent(module, 300, 7, 1);
+  events_consumed = 0;
+
+  std::thread producer([&module]() {
+    for (unsigned int i = 0; i < NUM_FRAMES; i++) {
+      CANFrame frame = makeFrame(3, (i % 2) ? OPC_ACOF : OPC_ACON, 300, 7);
+
+      while (!module.cbus.receiveFrame(&frame)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  for (unsigned long spins = 0; events_consumed < NUM_FRAMES && spins < 100000000UL; spins++) {
+    module.cbus.process();
+  }
+
+  producer.join();
+  settle(module.cbus);
+  CHECK(events_consumed == NUM_FRAMES);
+  CHECK(!last_event_on);
+}
+
+//
+/// a full transmit queue rejects new frames, whatever their priority, and keeps the frames it has accepted
+//
+
+static void testTxQueueFull(void) {
+
+  TestModule module(256, 1);
+  CANFrame frame;
+  byte accepted = 0;
+
+  // the simulated controller holds one frame until it is collected, so later frames wait in the queue
+  module.cbus.setTxCapacity(1);
+
+  for (byte i = 0; i < TX_QUEUE_SIZE + 1; i++) {
+    frame = makeFrame(1, OPC_ACON, 256, i + 1);
+
+    if (module.cbus.queueMessage(&frame, false, false, 0x0b)) {
+      ++accepted;
+    }
+  }
+
+  CHECK(accepted == TX_QUEUE_SIZE + 1);
+  CHECK(module.cbus.txQueueCount() == TX_QUEUE_SIZE);
+
+  frame = makeFrame(1, OPC_WRACK, 256, 0, 3);
+  CHECK(!module.cbus.queueMessage(&frame, false, false, 0x07));
+  CHECK(module.cbus._numMsgsDropped == 1);
+
+  // every accepted frame reaches the bus, in order
+  for (byte i = 0; i < TX_QUEUE_SIZE + 1; i++) {
+    CHECK(module.cbus.getSentMessage(&frame));
+    CHECK(frame.data[0] == OPC_ACON && frame.data[4] == i + 1);
+    module.cbus.process();
+  }
+
+  CHECK(!module.cbus.getSentMessage(&frame));
+
+  // an event refused by the full queue does not use up the rate limit
+  module.cbus.setEventRateLimit(1, 1000);
+
+  for (byte i = 0; i < TX_QUEUE_SIZE + 1; i++) {
+    frame = makeFrame(1, OPC_ACON, 256, i + 1);
+    module.cbus.queueMessage(&frame);
+  }
+
+  CHECK(!module.cbus.sendEvent(9, true));
+
+  // drained without the clock moving, so no token is earned meanwhile
+  module.cbus.setTxCapacity(0);
+  module.cbus.process();
+  CHECK(module.cbus.txQueueCount() == 0);
+  module.cbus.clearSent();
+
+  CHECK(module.cbus.sendEvent(9, true));
+  CHECK(!module.cbus.sendEvent(10, true));
+  module.cbus.setEventRateLimit(0, 0);
+}
+
+//
+/// the state of a produced event is reported to AREQ only once the event has been accepted for sending
+//
+
+static bool requestEventState(TestModule &module, unsigned int en, CANFrame *reply, byte opc = OPC_AREQ) {
+
+  CANFrame frame = makeFrame(2, opc, module.cfg.nodeNum, en);
+
+  module.cbus.clearSent();
+  module.cbus.inject(&frame);
+  settle(module.cbus);
+  return module.cbus.getSentMessage(reply);
+}
+
+static void testProducedEvents(void) {
+
+  TestModule module(256, 1);
+  byte states[PRODUCED_STATE_BYTES(16)];
+  CANFrame frame;
+
+  module.cbus.setProducedEventStates(states, 1, 16);
+
+  // data bytes are ignored when there is no data
+  CHECK(module.cbus.sendEvent(5, true, false, nullptr, 2));
+  CHECK(module.cbus.getSentMessage(&frame));
+  CHECK(frame.len == 5 && frame.data[0] == OPC_ACON);
+
+  CHECK(requestEventState(module, 5, &frame) && frame.data[0] == OPC_ARON);
+
+  // an event rejected by a full transmit queue does not change the recorded state
+  module.cbus.setTxCapacity(1);
+
+  for (byte i = 0; i < TX_QUEUE_SIZE + 1; i++) {
+    frame = makeFrame(1, OPC_WRACK, 256, 0, 3);
+    module.cbus.queueMessage(&frame, false, false, 0x0b);
+  }
+
+  CHECK(!module.cbus.sendEvent(5, false));
+  module.cbus.setTxCapacity(0);
+  settle(module.cbus);
+
+  CHECK(requestEventState(module, 5, &frame) && frame.data[0] == OPC_ARON);
+
+  // a long and a short event with the same number have their own states
+  CHECK(!requestEventState(module, 5, &frame, OPC_ASRQ));
+  CHECK(module.cbus.sendEvent(5, false, true));
+  settle(module.cbus);
+  CHECK(requestEventState(module, 5, &frame, OPC_ASRQ) && frame.data[0] == OPC_ARSOF);
+  CHECK(requestEventState(module, 5, &frame) && frame.data[0] == OPC_ARON);
+
+  // long events produced under a previous node number are no longer known
+  module.cfg.setNodeNum(400);
+  CHECK(!requestEventState(module, 5, &frame));
+  CHECK(requestEventState(module, 5, &frame, OPC_ASRQ) && frame.data[0] == OPC_ARSOF);
+
+  // asking does not change the states, so they are found again under the node number they were produced under
+  module.cfg.setNodeNum(256);
+  CHECK(requestEventState(module, 5, &frame) && frame.data[0] == OPC_ARON);
+
+  // without a node number, long events are not recorded, and are not taken for short events
+  module.cfg.setNodeNum(0);
+  CHECK(module.cbus.sendEvent(6, true));
+  settle(module.cbus);
+  CHECK(!requestEventState(module, 6, &frame));
+  CHECK(!requestEventState(module, 6, &frame, OPC_ASRQ));
+
+  module.cbus.setProducedEventStates(nullptr, 0, 0);
+}
+
+//
+/// CRC16 of long messages matches the original bitwise calculation
+//
+
+static uint16_t crc16Reference(const byte *data, unsigned int len) {
+
+  uint16_t crc = 0xffff;
+
+  for (unsigned int i = 0; i < len; i++) {
+    byte b = data[i];
+
+    for (byte j = 0; j < 8; j++, b >>= 1) {
+      crc = ((crc ^ b) & 1) ? (crc >> 1) ^ 0x8408 : (crc >> 1);
+    }
+  }
+
+  crc = ~crc;
+  return (crc << 8) | (crc >> 8);
+}
+
+static void testCRC16(void) {
+
+  byte data[300];
+  byte check_string[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+
+  CHECK(crc16(check_string, sizeof(check_string)) == 0x6e90);
+
+  for (unsigned int i = 0; i < sizeof(data); i++) {
+    data[i] = (byte)(i * 37 + 11);
+  }
+
+  for (unsigned int len = 0; len <= sizeof(data); len += 13) {
+    CHECK(crc16(data, len) == crc16Reference(data, len));
+  }
+
+  uint16_t crc = crc16_init();
+  crc = crc16_update(crc, data, 100);
+  crc = crc16_update(crc, data + 100, 200);
+  CHECK(crc16_final(crc) == crc16(data, 300));
+}
+
+//
+/// a binary long message, including zero bytes, is received intact with its CRC checked
+//
+
+static byte long_message_received[512];
+static unsigned int long_message_received_len = 0;
+static byte long_message_status = 0xff;
+
+static void longmessagehandler(void *msg, unsigned int msg_len, byte stream_id, byte status) {
+
+  (void)stream_id;
+  memcpy(long_message_received, msg, msg_len);
+  long_message_received_len = msg_len;
+  long_message_status = status;
+}
+
+static void transferLongMessage(CBUSLongMessageEx &lmsg_send, TestModule &sender, CBUSLongMessageEx &lmsg_receive, TestModule &receiver) {
+
+  for (unsigned int i = 0; i < 10000 && lmsg_send.is_sending(); i++) {
+    lmsg_send.process();
+    sender.cbus.process();
+    receiver.cbus.process(255);
+    lmsg_receive.process();
+    VirtualClock::advanceMillis(1);
+  }
+
+  settle(receiver.cbus);
+}
+
+static void testLongMessage(void) {
+
+  TestModule sender(256, 1), receiver(257, 2);
+  static byte stream_ids[] = { 5 };
+  byte message[300];
+
+  sender.cbus.connect(&receiver.cbus);
+
+  CBUSLongMessageEx lmsg_send(&sender.cbus);
+  CBUSLongMessageEx lmsg_receive(&receiver.cbus);
+
+  // a caller-supplied arena must be large enough for the contexts and buffers requested
+  static byte receive_arena[LONG_MESSAGE_ARENA_BYTES(2, sizeof(long_message_received), 1, EX_BUFFER_LEN)];
+  CHECK(!lmsg_receive.allocateContexts(2, sizeof(long_message_received), 1, receive_arena, sizeof(receive_arena) - 1));
+  CHECK(!lmsg_receive.allocateContexts(3, sizeof(long_message_received), 1, receive_arena, sizeof(receive_arena)));
+  CHECK(lmsg_receive.allocateContexts(2, sizeof(long_message_received), 1, receive_arena, sizeof(receive_arena)));
+  lmsg_receive.subscribe(stream_ids, sizeof(stream_ids), longmessagehandler);
+  lmsg_send.use_crc(true);
+  lmsg_receive.use_crc(true);
+
+  for (unsigned int i = 0; i < sizeof(message); i++) {
+    message[i] = (byte)(i * 7);
+  }
+
+  // contexts allocated without a send buffer length copy messages of up to EX_BUFFER_LEN bytes
+  CHECK(lmsg_send.allocateContexts(1, 8, 2));
+  CHECK(!lmsg_send.sendLongMessage(message, EX_BUFFER_LEN + 1, 5));
+
+  long_message_status = 0xff;
+  CHECK(lmsg_send.sendLongMessage(message, EX_BUFFER_LEN, 5));
+  transferLongMessage(lmsg_send, sender, lmsg_receive, receiver);
+
+  CHECK(long_message_status == CBUS_LONG_MESSAGE_COMPLETE);
+  CHECK(long_message_received_len == EX_BUFFER_LEN);
+  CHECK(memcmp(long_message_received, message, EX_BUFFER_LEN) == 0);
+
+  // longer messages need a larger send buffer pool
+  CHECK(lmsg_send.allocateContextsBuffers(1, 8, 2, sizeof(message)));
+  CHECK(!lmsg_send.sendLongMessage(message, sizeof(message) + 1, 5));
+
+  long_message_status = 0xff;
+  CHECK(lmsg_send.sendLongMessage(message, sizeof(message), 5));
+  transferLongMessage(lmsg_send, sender, lmsg_receive, receiver);
+
+  CHECK(long_message_status == CBUS_LONG_MESSAGE_COMPLETE);
+  CHECK(long_message_received_len == sizeof(message));
+  CHECK(memcmp(long_message_received, message, sizeof(message)) == 0);
+}
+
+//
+/// a fragment that cannot be sent is retried, and the message is abandoned only after LONG_MESSAGE_SEND_RETRIES attempts
+//
+
+static byte long_message_send_status = 0xff;
+
+static void longmessagesent(const void *msg, unsigned int msg_len, byte stream_id, byte status) {
+
+  (void)msg;
+  (void)msg_len;
+  (void)stream_id;
+  long_message_send_status = status;
+}
+
+static void testLongMessageRetry(void) {
+
+  TestModule sender(256, 1), receiver(257, 2);
+  static byte stream_ids[] = { 5 };
+  byte message[40];
+  CANFrame frame = makeFrame(3, OPC_ACON, 300, 7);
+
+  sender.cbus.connect(&receiver.cbus);
+
+  CBUSLongMessageEx lmsg_send(&sender.cbus);
+  CBUSLongMessageEx lmsg_receive(&receiver.cbus);
+
+  CHECK(lmsg_send.allocateContexts(1, 8, 1));
+  CHECK(lmsg_receive.allocateContexts(1, sizeof(long_message_received), 1));
+  lmsg_receive.subscribe(stream_ids, sizeof(stream_ids), longmessagehandler);
+
+  for (unsigned int i = 0; i < sizeof(message); i++) {
+    message[i] = (byte)(i * 3);
+  }
+
+  for (byte pass = 0; pass < 2; pass++) {
+    // the controller is kept busy, so the transmit queue fills and fragments cannot be sent
+    sender.cbus.clearSent();
+    sender.cbus.setTxCapacity(1);
+    CHECK(sender.cbus.sendMessage(&frame));
+
+    long_message_status = long_message_send_status = 0xff;
+    CHECK(lmsg_send.sendLongMessage(message, sizeof(message), 5, DEFAULT_PRIORITY, longmessagesent));
+
+    unsigned int ms = (TX_QUEUE_SIZE + LONG_MESSAGE_SEND_RETRIES) * (LONG_MESSAGE_DEFAULT_DELAY + 1) - LONG_MESSAGE_DEFAULT_DELAY;
+
+    for (unsigned int i = 0; i < ms; i++) {
+      lmsg_send.process();
+      sender.cbus.process();
+      VirtualClock::advanceMillis(1);
+    }
+
+    if (pass == 0) {
+      // freed before the retries run out, the same fragment is sent and the message arrives intact
+      CHECK(lmsg_send.is_sending());
+      CHECK(long_message_send_status == 0xff);
+
+      sender.cbus.clearSent();
+      sender.cbus.setTxCapacity(0);
+      transferLongMessage(lmsg_send, sender, lmsg_receive, receiver);
+
+      CHECK(long_message_send_status == CBUS_LONG_MESSAGE_COMPLETE);
+      CHECK(long_message_status == CBUS_LONG_MESSAGE_COMPLETE);
+      CHECK(long_message_received_len == sizeof(message));
+      CHECK(memcmp(long_message_received, message, sizeof(message)) == 0);
+    } else {
+      // still busy, the message is abandoned
+      for (unsigned int i = 0; i < 2 * (LONG_MESSAGE_DEFAULT_DELAY + 1); i++) {
+        lmsg_send.process();
+        sender.cbus.process();
+        VirtualClock::advanceMillis(1);
+      }
+
+      CHECK(!lmsg_send.is_sending());
+      CHECK(long_message_send_status == CBUS_LONG_MESSAGE_SEND_ERROR);
+    }
+  }
+
+  sender.cbus.clearSent();
+  sender.cbus.setTxCapacity(0);
+  settle(receiver.cbus);
+}
+
+//
+/// the basic long message class receives only the streams it is subscribed to
+//
+
+static void testLongMessageLite(void) {
+
+  TestModule sender(256, 1), receiver(257, 2);
+  static byte stream_ids[] = { 3, 5 };
+  static byte receive_buffer[64];
+  byte message[40];
+
+  sender.cbus.connect(&receiver.cbus);
+
+  CBUSLongMessageEx lmsg_send(&sender.cbus);
+  CBUSLongMessage lmsg_receive(&receiver.cbus);
+
+  CHECK(lmsg_send.allocateContextsBuffers(1, 8, 1, sizeof(message)));
+  lmsg_receive.subscribe(stream_ids, sizeof(stream_ids), receive_buffer, sizeof(receive_buffer), longmessagehandler);
+
+  for (byte stream_id = 4; stream_id <= 5; stream_id++) {
+    for (unsigned int i = 0; i < sizeof(message); i++) {
+      message[i] = (byte)(i + stream_id);
+    }
+
+    long_message_status = 0xff;
+    long_message_received_len = 0;
+    CHECK(lmsg_send.sendLongMessage(message, sizeof(message), stream_id));
+
+    for (unsigned int i = 0; i < 10000 && lmsg_send.is_sending(); i++) {
+      lmsg_send.process();
+      sender.cbus.process();
+      receiver.cbus.process(255);
+      lmsg_receive.process();
+      VirtualClock::advanceMillis(1);
+    }
+
+    settle(receiver.cbus);
+
+    if (stream_id == 4) {
+      CHECK(long_message_status == 0xff);
+    }
+  }
+
+  // only the message on stream 5 was received
+  CHECK(long_message_status == CBUS_LONG_MESSAGE_COMPLETE);
+  CHECK(long_message_received_len == sizeof(message));
+  CHECK(memcmp(long_message_received, message, sizeof(message)) == 0);
+}
+
+int main(void) {
+
+  VirtualClock::install();
+  config.begin();
+
+  testFLiMSetup();
+  testFLiMSetupLoopback();
+  testAccessoryEvents();
+  testEventFilter();
+  testOwnEvents();
+  testEventQueue();
+  testOpcodeHandlers();
+  testReceiveBatch();
+  testReceiveThread();
+  testTxQueueFull();
+  testProducedEvents();
+  testCRC16();
+  testLongMessage();
+  testLongMessageRetry();
+  testLongMessageLite();
+
+  printf("%u checks, %u failed\n", num_checks, num_failures);
+  return (num_failures > 0) ? 1 : 0;
+}
@@ -44,6 +44,83 @@
 // forward function declarations
 void makeHeader_impl(CANFrame *msg, byte id, byte priority = 0x0b);
 
+//
+/// opcode classification flags
+//
+
+#define OPF_HANDLED 0x01                  // opcode is processed by this library
+#define OPF_ADDRESSED 0x02                // frame carries a target node number which must be ours
+#define OPF_LEARN 0x04                    // only processed in learn mode
+#define OPF_MODE_CHANGING 0x08            // only processed during the SLiM/FLiM transition
+#define OPF_ACC_EVENT 0x10                // accessory event, looked up in the event table
+#define OPF_SHORT_EVENT 0x20              // short accessory event, stored with a node number of zero
+
+//
+/// classify an opcode -- evaluated at compile time to build the opcode table
+//
+
+static constexpr byte opcodeFlags(byte opc) {
+
+  return
+    (opc == OPC_ACON || opc == OPC_ACON1 || opc == OPC_ACON2 || opc == OPC_ACON3 ||
+     opc == OPC_ACOF || opc == OPC_ACOF1 || opc == OPC_ACOF2 || opc == OPC_ACOF3 ||
+     opc == OPC_ARON || opc == OPC_AROF) ? (OPF_HANDLED | OPF_ACC_EVENT) :
+
+    (opc == OPC_ASON || opc == OPC_ASON1 || opc == OPC_ASON2 || opc == OPC_ASON3 ||
+     opc == OPC_ASOF || opc == OPC_ASOF1 || opc == OPC_ASOF2 || opc == OPC_ASOF3) ? (OPF_HANDLED | OPF_ACC_EVENT | OPF_SHORT_EVENT) :
+
+    (opc == OPC_RQNPN || opc == OPC_CANID || opc == OPC_ENUM || opc == OPC_NVRD || opc == OPC_NVSET ||
+     opc == OPC_NNLRN || opc == OPC_NNULN || opc == OPC_RQEVN || opc == OPC_NERD || opc == OPC_REVAL ||
+     opc == OPC_NNEVN) ? (OPF_HANDLED | OPF_ADDRESSED) :
+
+    (opc == OPC_NNCLR) ? (OPF_HANDLED | OPF_ADDRESSED | OPF_LEARN) :
+
+    (opc == OPC_EVLRN || opc == OPC_EVULN) ? (OPF_HANDLED | OPF_LEARN) :
+
+    (opc == OPC_RQNP || opc == OPC_RQMN || opc == OPC_SNN || opc == OPC_RQNN) ? (OPF_HANDLED | OPF_MODE_CHANGING) :
+
+    (opc == OPC_AREQ) ? (OPF_HANDLED | OPF_ADDRESSED) :
+
+    (opc == OPC_QNN || opc == OPC_DTXC || opc == OPC_ASRQ) ? OPF_HANDLED :
+
+    0;
+}
+
+#define OPF_ROW(n) \
+  opcodeFlags(n + 0x0), opcodeFlags(n + 0x1), opcodeFlags(n + 0x2), opcodeFlags(n + 0x3), \
+  opcodeFlags(n + 0x4), opcodeFlags(n + 0x5), opcodeFlags(n + 0x6), opcodeFlags(n + 0x7), \
+  opcodeFlags(n + 0x8), opcodeFlags(n + 0x9), opcodeFlags(n + 0xa), opcodeFlags(n + 0xb), \
+  opcodeFlags(n + 0xc), opcodeFlags(n + 0xd), opcodeFlags(n + 0xe), opcodeFlags(n + 0xf)
+
+//
+/// the opcode table -- one lookup classifies each received frame
+/// held in flash on AVR
+//
+
+static const byte opcode_table[256] PROGMEM = {
+  OPF_ROW(0x00), OPF_ROW(0x10), OPF_ROW(0x20), OPF_ROW(0x30),
+  OPF_ROW(0x40), OPF_ROW(0x50), OPF_ROW(0x60), OPF_ROW(0x70),
+  OPF_ROW(0x80), OPF_ROW(0x90), OPF_ROW(0xa0), OPF_ROW(0xb0),
+  OPF_ROW(0xc0), OPF_ROW(0xd0), OPF_ROW(0xe0), OPF_ROW(0xf0)
+};
+
+//
+/// the clock source, which defaults to the Arduino timing functions
+//
+
+unsigned long (*CBUSClock::_millis_fn)(void) = millis;
+unsigned long (*CBUSClock::_micros_fn)(void) = micros;
+
+void CBUSClock::setSource(unsigned long (*millis_fn)(void), unsigned long (*micros_fn)(void)) {
+  _millis_fn = millis_fn;
+  _micros_fn = micros_fn;
+}
+
+void CBUSClock::resetSource(void) {
+  _millis_fn = millis;
+  _micros_fn = micros;
+}
+
 //
 /// construct a CBUS object with an external CBUSConfig object named "config" that is defined
 /// in user code
@@ -80,12 +157,435 @@ void CBUSbase::setEventHandler(void (*fptr)(byte index, CANFrame *msg, bool ison
 //
 /// register the user handler for CAN frames
 /// default args in .h declaration for opcodes array (NULL) and size (0)
+/// the handler receives all frames if no opcodes are given
 //
 
 void CBUSbase::setFrameHandler(void (*fptr)(CANFrame *msg), byte opcodes[], byte num_opcodes) {
   framehandler = fptr;
-  _opcodes = opcodes;
-  _num_opcodes = num_opcodes;
+
+  if (num_opcodes > 0) {
+    removeFrameHandlerOpcodes(0x00, 0xff);
+
+    for (byte i = 0; i < num_opcodes; i++) {
+      addFrameHandlerOpcode(opcodes[i]);
+    }
+  } else {
+    addFrameHandlerOpcodes(0x00, 0xff);
+  }
+}
+
+//
+/// add or remove opcodes, or ranges of opcodes, passed to the user frame handler
+/// the filter is held as a bitmap so the check costs the same whatever the number of opcodes
+//
+
+void CBUSbase::addFrameHandlerOpcode(byte opcode) {
+  bitSet(_opcode_filter[opcode >> 3], opcode & 0x07);
+}
+
+void CBUSbase::removeFrameHandlerOpcode(byte opcode) {
+  bitClear(_opcode_filter[opcode >> 3], opcode & 0x07);
+}
+
+void CBUSbase::addFrameHandlerOpcodes(byte first_opcode, byte last_opcode) {
+  for (unsigned int opc = first_opcode; opc <= last_opcode; opc++) {
+    addFrameHandlerOpcode(opc);
+  }
+}
+
+void CBUSbase::removeFrameHandlerOpcodes(byte first_opcode, byte last_opcode) {
+  for (unsigned int opc = first_opcode; opc <= last_opcode; opc++) {
+    removeFrameHandlerOpcode(opc);
+  }
+}
+
+//
+/// register a handler, with a context pointer passed back on each call, for an opcode or a range of opcodes
+/// several handlers may be registered, so that independent components can share one CBUS object
+/// handlers are called from the opcode table lookup for every matching standard data frame, in the order they were
+/// registered, before the frame is processed; extended and RTR frames are not passed to them
+/// a bit map of the opcodes with handlers means frames with other opcodes cost a single bit test
+/// returns false if MAX_OPCODE_HANDLERS are already registered
+//
+
+bool CBUSbase::addOpcodeHandler(byte opcode, opcode_handler_t fptr, void *context) {
+  return addOpcodeHandler(opcode, opcode, fptr, context);
+}
+
+bool CBUSbase::addOpcodeHandler(byte first_opcode, byte last_opcode, opcode_handler_t fptr, void *context) {
+
+  if (_num_opcode_handlers == MAX_OPCODE_HANDLERS || fptr == nullptr) {
+    return false;
+  }
+
+  opcode_handler_entry_t *entry = &_opcode_handlers[_num_opcode_handlers++];
+  entry->handler = fptr;
+  entry->context = context;
+  entry->first_opcode = first_opcode;
+  entry->last_opcode = last_opcode;
+
+  for (unsigned int opc = first_opcode; opc <= last_opcode; opc++) {
+    bitSet(_handler_opcodes[opc >> 3], opc & 0x07);
+  }
+
+  return true;
+}
+
+//
+/// remove all registrations of a handler with this context
+/// a handler may remove itself or another handler from its callback; the entries are then only marked, so the
+/// dispatch loop is not disturbed, and are removed once all the handlers for the frame have been called
+//
+
+void CBUSbase::removeOpcodeHandler(opcode_handler_t fptr, void *context) {
+
+  for (byte i = 0; i < _num_opcode_handlers; i++) {
+    opcode_handler_entry_t *entry = &_opcode_handlers[i];
+
+    if (entry->handler == fptr && entry->context == context) {
+      entry->handler = nullptr;
+      _opcode_handler_removed = true;
+    }
+  }
+
+  if (!_calling_opcode_handlers) {
+    compactOpcodeHandlers();
+  }
+}
+
+//
+/// drop removed handler entries and rebuild the bit map of opcodes with handlers
+//
+
+void CBUSbase::compactOpcodeHandlers(void) {
+
+  byte j = 0;
+
+  if (!_opcode_handler_removed) {
+    return;
+  }
+
+  memset(_handler_opcodes, 0, sizeof(_handler_opcodes));
+
+  for (byte i = 0; i < _num_opcode_handlers; i++) {
+    opcode_handler_entry_t *entry = &_opcode_handlers[i];
+
+    if (entry->handler == nullptr) {
+      continue;
+    }
+
+    for (unsigned int opc = entry->first_opcode; opc <= entry->last_opcode; opc++) {
+      bitSet(_handler_opcodes[opc >> 3], opc & 0x07);
+    }
+
+    _opcode_handlers[j++] = *entry;
+  }
+
+  _num_opcode_handlers = j;
+  _opcode_handler_removed = false;
+}
+
+//
+/// call the handlers registered for this frame's opcode
+/// handlers added from a callback are first called for the next frame
+//
+
+void CBUSbase::callOpcodeHandlers(CANFrame *msg) {
+
+  byte opc = msg->data[0];
+  byte num_handlers = _num_opcode_handlers;
+
+  _calling_opcode_handlers = true;
+
+  for (byte i = 0; i < num_handlers; i++) {
+    opcode_handler_entry_t *entry = &_opcode_handlers[i];
+
+    if (entry->handler != nullptr && opc >= entry->first_opcode && opc <= entry->last_opcode) {
+      (*entry->handler)(msg, entry->context);
+    }
+  }
+
+  _calling_opcode_handlers = false;
+  compactOpcodeHandlers();
+}
+
+//
+/// produce an accessory event, long or short, with up to 3 data bytes
+/// the opcode is chosen from the event type, state and number of data bytes, e.g. ACON, ACOF2 or ASON1
+/// if an event producer queue has been set, the event is sent in turn from process() as the rate limit allows,
+/// and an event that is already waiting is updated with the new state and data rather than queued again
+/// without a queue, the event is sent immediately if the rate limit allows
+/// the event's state is recorded for AREQ and ASRQ only once the event has been accepted
+/// returns false if the event was dropped
+//
+
+bool CBUSbase::sendEvent(unsigned int en, bool is_on, bool is_short, const byte *data, byte data_len) {
+
+  produced_event_t event;
+
+  event.en = en;
+  event.is_on = is_on;
+  event.is_short = is_short;
+  event.data_len = (data == nullptr) ? 0 : (data_len > 3) ? 3 : data_len;
+
+  for (byte i = 0; i < event.data_len; i++) {
+    event.data[i] = data[i];
+  }
+
+  if (_producer_queue == nullptr) {
+    if (takeProducerToken()) {
+      if (sendProducedEvent(&event)) {
+        recordProducedEvent(en, is_on, is_short);
+        return true;
+      }
+
+      // the event was not sent, so it does not use up the rate limit
+      _producer_tokens += (_producer_burst > 0);
+    }
+
+    ++_numProducedDropped;
+    return false;
+  }
+
+  // coalesce with an event that is already waiting
+  for (byte i = 0, slot = _producer_head; i < _producer_count; i++, slot = (slot + 1 == _producer_size) ? 0 : slot + 1) {
+    if (_producer_queue[slot].en == en && _producer_queue[slot].is_short == is_short) {
+      _producer_queue[slot] = event;
+      ++_numProducedCoalesced;
+      recordProducedEvent(en, is_on, is_short);
+      return true;
+    }
+  }
+
+  // send immediately if nothing is waiting ahead of this event
+  // with the transmit queue empty, the frame is always accepted, by the controller or the queue
+  if (_producer_count == 0 && _tx_queue_count == 0 && takeProducerToken()) {
+    sendProducedEvent(&event);
+    recordProducedEvent(en, is_on, is_short);
+    return true;
+  }
+
+  if (_producer_count == _producer_size) {
+    ++_numProducedDropped;
+    return false;
+  }
+
+  unsigned int tail = _producer_head + _producer_count;
+
+  if (tail >= _producer_size) {
+    tail -= _producer_size;
+  }
+
+  _producer_queue[tail] = event;
+  ++_producer_count;
+  recordProducedEvent(en, is_on, is_short);
+  return true;
+}
+
+//
+/// set a user-supplied array to hold events waiting to be sent, or nullptr to send events immediately
+//
+
+void CBUSbase::setEventProducer(produced_event_t *entries, byte num_entries) {
+
+  _producer_queue = (num_entries > 0) ? entries : nullptr;
+  _producer_size = (_producer_queue != nullptr) ? num_entries : 0;
+  _producer_head = 0;
+  _producer_count = 0;
+}
+
+//
+/// limit the rate of produced events with a token bucket: bursts of up to burst events, then one event per interval_ms
+/// a burst of zero removes the limit
+//
+
+void CBUSbase::setEventRateLimit(byte burst, unsigned int interval_ms) {
+
+  _producer_burst = burst;
+  _producer_tokens = burst;
+  _producer_interval_ms = interval_ms;
+  _producer_refill_time = CBUSClock::ms();
+}
+
+byte CBUSbase::eventProducerCount(void) {
+
+  return _producer_count;
+}
+
+//
+/// take a token from the bucket, after adding any tokens earned since the last refill
+//
+
+bool CBUSbase::takeProducerToken(void) {
+
+  if (_producer_burst == 0) {
+    return true;
+  }
+
+  if (_producer_tokens < _producer_burst && _producer_interval_ms > 0) {
+    unsigned long earned = (CBUSClock::ms() - _producer_refill_time) / _producer_interval_ms;
+
+    if (earned >= (unsigned long)(_producer_burst - _producer_tokens)) {
+      _producer_tokens = _producer_burst;
+      _producer_refill_time = CBUSClock::ms();
+    } else {
+      _producer_tokens += earned;
+      _producer_refill_time += earned * _producer_interval_ms;
+    }
+  }
+
+  if (_producer_tokens == 0) {
+    return false;
+  }
+
+  if (_producer_tokens == _producer_burst) {
+    // a full bucket earns nothing, so start timing the refill now
+    _producer_refill_time = CBUSClock::ms();
+  }
+
+  --_producer_tokens;
+  return true;
+}
+
+//
+/// set user-supplied storage to record the latest state of each produced event in a range of event numbers,
+/// so that AREQ and ASRQ requests are answered directly, without calling user code
+/// the storage must be PRODUCED_STATE_BYTES(num_events) bytes; events become known when produced with sendEvent()
+//
+
+void CBUSbase::setProducedEventStates(byte *storage, unsigned int first_en, unsigned int num_events) {
+
+  _produced_states = (num_events > 0) ? storage : nullptr;
+  _produced_first_en = first_en;
+  _produced_num_events = (_produced_states != nullptr) ? num_events : 0;
+  _produced_nn = module_config->nodeNum;
+
+  if (_produced_states != nullptr) {
+    memset(_produced_states, 0, PRODUCED_STATE_BYTES(num_events));
+  }
+}
+
+//
+/// find the byte of the known bitset holding the state of a produced event, keyed on (NN, EN) with a node number of
+/// zero for short events; the on bitset follows the known bitset
+/// long event states belong to the node number they were recorded under, and are not found under any other
+/// returns nullptr if the event is outside the range, or is a long event not produced under this node number
+//
+
+byte *CBUSbase::producedEventState(unsigned int nn, unsigned int en, bool is_short, byte *bit) {
+
+  unsigned int offset = en - _produced_first_en;
+  unsigned int nbytes = (_produced_num_events + 7) / 8;
+
+  if (en < _produced_first_en || offset >= _produced_num_events) {
+    return nullptr;
+  }
+
+  if (!is_short && (nn == 0 || nn != module_config->nodeNum || nn != _produced_nn)) {
+    return nullptr;
+  }
+
+  *bit = offset & 7;
+  return &_produced_states[(is_short ? 2 * nbytes : 0) + (offset >> 3)];
+}
+
+//
+/// record the state of an event produced by this node
+/// long events are not recorded without a node number, and those recorded under a previous node number are forgotten
+//
+
+void CBUSbase::recordProducedEvent(unsigned int en, bool is_on, bool is_short) {
+
+  unsigned int nn = is_short ? 0 : module_config->nodeNum;
+
+  if (_produced_states == nullptr || (!is_short && nn == 0)) {
+    return;
+  }
+
+  if (!is_short && nn != _produced_nn) {
+    memset(_produced_states, 0, 2 * ((_produced_num_events + 7) / 8));
+    _produced_nn = nn;
+  }
+
+  byte bit, *known = producedEventState(nn, en, is_short, &bit);
+
+  if (known == nullptr) {
+    return;
+  }
+
+  bitSet(known[0], bit);
+  bitWrite(known[(_produced_num_events + 7) / 8], bit, is_on);
+}
+
+//
+/// answer a request for the state of a produced event, if it is known
+//
+
+bool CBUSbase::sendEventState(unsigned int nn, unsigned int en, bool is_short) {
+
+  byte bit, *known = producedEventState(nn, en, is_short, &bit);
+  CANFrame frame;
+
+  if (known == nullptr || !bitRead(known[0], bit)) {
+    return false;
+  }
+
+  bool is_on = bitRead(known[(_produced_num_events + 7) / 8], bit);
+
+  frame.len = 5;
+  frame.data[0] = is_short ? (is_on ? OPC_ARSON : OPC_ARSOF) : (is_on ? OPC_ARON : OPC_AROF);
+  frame.data[1] = highByte(module_config->nodeNum);
+  frame.data[2] = lowByte(module_config->nodeNum);
+  frame.data[3] = highByte(en);
+  frame.data[4] = lowByte(en);
+
+  return queueMessage(&frame);
+}
+
+//
+/// build the event frame and pass it to the transmit queue
+//
+
+bool CBUSbase::sendProducedEvent(produced_event_t *event) {
+
+  CANFrame frame;
+
+  frame.len = 5 + event->data_len;
+  frame.data[0] = OPC_ACON + (event->data_len << 5) + (event->is_short ? 8 : 0) + (event->is_on ? 0 : 1);
+  frame.data[1] = highByte(module_config->nodeNum);
+  frame.data[2] = lowByte(module_config->nodeNum);
+  frame.data[3] = highByte(event->en);
+  frame.data[4] = lowByte(event->en);
+
+  for (byte i = 0; i < event->data_len; i++) {
+    frame.data[5 + i] = event->data[i];
+  }
+
+  if (!queueMessage(&frame)) {
+    return false;
+  }
+
+  ++_numProducedEvents;
+  return true;
+}
+
+//
+/// send waiting events as the rate limit allows
+/// events are only passed on while the transmit queue is empty, so that they never crowd out replies,
+/// and an event is only taken from this queue once it has been accepted
+//
+
+void CBUSbase::processProducer(void) {
+
+  while (_producer_count > 0 && _tx_queue_count == 0 && takeProducerToken()) {
+    if (!sendProducedEvent(&_producer_queue[_producer_head])) {
+      _producer_tokens += (_producer_burst > 0);
+      break;
+    }
+
+    _producer_head = (_producer_head + 1 == _producer_size) ? 0 : _producer_head + 1;
+    --_producer_count;
+  }
 }
 
 //
@@ -119,6 +619,7 @@ void CBUSbase::setName(unsigned char *mname) {
 void CBUSbase::setSLiM(void) {
 
   bModeChanging = false;
+  cancelResponder();
   module_config->setNodeNum(0);
   module_config->setFLiM(false);
   module_config->setCANID(0);
@@ -135,6 +636,127 @@ inline byte CBUSbase::getCANID(unsigned long header) {
   return header & 0x7f;
 }
 
+//
+/// send a frame, or hold it in the transmit queue if the CAN controller cannot accept it now
+/// queued frames are kept in priority order, lower values being more urgent, and frames of equal
+/// priority are sent in the order they were queued
+/// when the queue is full, this frame is rejected and counted, and frames already accepted are never dropped
+/// returns false if this frame was rejected, so the caller can retry or report the failure
+//
+
+bool CBUSbase::queueMessage(CANFrame *msg, bool rtr, bool ext, byte priority) {
+
+  // send immediately if nothing is waiting ahead of this frame
+  if (_tx_queue_count == 0 && sendMessage(msg, rtr, ext, priority)) {
+    loopbackFrame(msg, rtr, ext);
+    return true;
+  }
+
+  if (_tx_queue_count == TX_QUEUE_SIZE) {
+    ++_numMsgsDropped;
+    return false;
+  }
+
+  // find the insertion point, after all frames of the same or higher priority
+  byte i = _tx_queue_count;
+
+  while (i > 0 && _tx_queue[i - 1].current_priority > priority) {
+    _tx_queue[i] = _tx_queue[i - 1];
+    --i;
+  }
+
+  _tx_queue[i].frame = *msg;
+  _tx_queue[i].priority = priority;
+  _tx_queue[i].current_priority = priority;
+  _tx_queue[i].rtr = rtr;
+  _tx_queue[i].ext = ext;
+  _tx_queue[i].queued_at = CBUSClock::ms();
+  ++_tx_queue_count;
+  ++_numMsgsQueued;
+
+  return true;
+}
+
+//
+/// send queued frames until the queue is empty or the CAN controller is busy
+//
+
+void CBUSbase::processTxQueue(void) {
+
+  byte sent = 0;
+
+  if (_escalation_stage_ms > 0) {
+    escalateTxQueue();
+  }
+
+  while (sent < _tx_queue_count && sendMessage(&_tx_queue[sent].frame, _tx_queue[sent].rtr, _tx_queue[sent].ext, _tx_queue[sent].current_priority)) {
+    loopbackFrame(&_tx_queue[sent].frame, _tx_queue[sent].rtr, _tx_queue[sent].ext);
+    ++sent;
+  }
+
+  if (sent > 0) {
+    for (byte i = sent; i < _tx_queue_count; i++) {
+      _tx_queue[i - sent] = _tx_queue[i];
+    }
+
+    _tx_queue_count -= sent;
+  }
+}
+
+//
+/// raise the priority of queued frames by one step for each stage_ms they have waited, up to max_priority,
+/// so that under sustained load a frame's wait is bounded rather than indefinite
+/// a stage_ms of zero disables escalation
+//
+
+void CBUSbase::setPriorityEscalation(unsigned int stage_ms, byte max_priority) {
+
+  _escalation_stage_ms = stage_ms;
+  _escalation_max_priority = max_priority;
+}
+
+//
+/// recalculate the priority of each queued frame from its age, and restore the queue order
+//
+
+void CBUSbase::escalateTxQueue(void) {
+
+  unsigned long now = CBUSClock::ms();
+
+  for (byte i = 0; i < _tx_queue_count; i++) {
+    tx_queue_entry_t *entry = &_tx_queue[i];
+
+    if (entry->priority > _escalation_max_priority) {
+      unsigned long steps = (now - entry->queued_at) / _escalation_stage_ms;
+      entry->current_priority = (steps < (unsigned long)(entry->priority - _escalation_max_priority)) ? entry->priority - steps : _escalation_max_priority;
+    }
+  }
+
+  // insertion sort, which keeps frames of equal priority in their current order
+  for (byte i = 1; i < _tx_queue_count; i++) {
+    if (_tx_queue[i].current_priority < _tx_queue[i - 1].current_priority) {
+      tx_queue_entry_t entry = _tx_queue[i];
+      byte j = i;
+
+      while (j > 0 && _tx_queue[j - 1].current_priority > entry.current_priority) {
+        _tx_queue[j] = _tx_queue[j - 1];
+        --j;
+      }
+
+      _tx_queue[j] = entry;
+    }
+  }
+}
+
+//
+/// number of frames waiting in the transmit queue
+//
+
+byte CBUSbase::txQueueCount(void) {
+
+  return _tx_queue_count;
+}
+
 //
 /// send a WRACK (write acknowledge) message
 //
@@ -148,7 +770,7 @@ bool CBUSbase::sendWRACK(void) {
   _msg.data[1] = highByte(module_config->nodeNum);
   _msg.data[2] = lowByte(module_config->nodeNum);
 
-  return sendMessage(&_msg);
+  return queueMessage(&_msg);
 }
 
 //
@@ -165,7 +787,7 @@ bool CBUSbase::sendCMDERR(byte cerrno) {
   _msg.data[2] = lowByte(module_config->nodeNum);
   _msg.data[3] = cerrno;
 
-  return sendMessage(&_msg);
+  return queueMessage(&_msg);
 }
 
 //
@@ -198,13 +820,13 @@ void CBUSbase::CANenumeration(void) {
 
   // set global variables
   bCANenum = true;                  // we are enumerating
-  CANenumTime = millis();           // the cycle start time
+  CANenumTime = CBUSClock::ms();           // the cycle start time
   memset(enum_responses, 0, sizeof(enum_responses));
 
   // send zero-length RTR frame
   _msg.len = 0;
   _msg.rtr = true;
-  sendMessage(&_msg, true, false);          // fixed arg order in v 1.1.4, RTR - true, ext = false
+  queueMessage(&_msg, true, false);          // fixed arg order in v 1.1.4, RTR - true, ext = false
 
   // DEBUG_SERIAL << F("> enumeration cycle initiated") << endl;
   return;
@@ -221,14 +843,14 @@ void CBUSbase::initFLiM(void) {
   indicateMode(MODE_CHANGING);
 
   bModeChanging = true;
-  timeOutTimer = millis();
+  timeOutTimer = CBUSClock::ms();
 
   // send RQNN message with current NN, which may be zero if a virgin/SLiM node
   _msg.len = 3;
   _msg.data[0] = OPC_RQNN;
   _msg.data[1] = highByte(module_config->nodeNum);
   _msg.data[2] = lowByte(module_config->nodeNum);
-  sendMessage(&_msg);
+  queueMessage(&_msg);
 
   // DEBUG_SERIAL << F("> requesting NN with RQNN message for NN = ") << module_config->nodeNum << endl;
   return;
@@ -248,7 +870,7 @@ void CBUSbase::revertSLiM(void) {
   _msg.data[1] = highByte(module_config->nodeNum);
   _msg.data[2] = lowByte(module_config->nodeNum);
 
-  sendMessage(&_msg);
+  queueMessage(&_msg);
   setSLiM();
   return;
 }
@@ -318,9 +940,116 @@ void CBUSbase::indicateMode(byte mode) {
 }
 
 /// main CBUS message processing procedure
+/// process up to num_messages received frames per run so the user's application code doesn't appear unresponsive under load
 
 void CBUSbase::process(byte num_messages) {
 
+  processUserInterface();
+
+  // get received CAN frames from buffer
+  // drain down the input buffer
+
+  byte mcount = 0;
+
+  while (mcount < num_messages && processNextMessage(num_messages - mcount)) {
+    ++mcount;
+  }
+
+  processResponder();
+  processTimers();
+  processTxQueue();
+  processProducer();
+
+  //
+  /// end of CBUS message processing
+  //
+}
+
+//
+/// time-budgeted variant of the main processing procedure
+/// processes received frames until the budget in microseconds is spent or no more frames are available
+/// the budget is checked before each frame, so a run may overrun by the cost of one frame
+/// returns the number of frames processed, and optionally reports the frames still pending and the time used
+/// frames_pending is exact only if the driver overrides pendingMessages() with a count of its receive buffer;
+/// with the default, the driver's buffer counts as at most one frame, and only zero or non-zero can be relied on
+//
+
+unsigned int CBUSbase::processFor(unsigned long budget_us, process_result_t *result) {
+
+  unsigned long start_time = CBUSClock::us();
+  unsigned int mcount = 0;
+
+  processUserInterface();
+
+  while ((CBUSClock::us() - start_time) < budget_us && processNextMessage()) {
+    ++mcount;
+  }
+
+  processResponder();
+  processTimers();
+  processTxQueue();
+  processProducer();
+
+  if (result != nullptr) {
+    result->frames_processed = mcount;
+    result->frames_pending = pendingMessages() + (_rx_batch_count - _rx_batch_index) + (byte)(_loopback_head - _loopback_tail) + ((coe_obj != nullptr) ? coe_obj->size() : 0);
+    result->elapsed_us = CBUSClock::us() - start_time;
+  }
+
+  return mcount;
+}
+
+//
+/// set a user-supplied array to receive frames from the driver in batches, or nullptr to receive one frame at a time
+/// without a batch array, each frame is received into _msg as before
+/// call during setup, before frames are processed
+//
+
+void CBUSbase::setReceiveBatch(CANFrame *frames, byte num_frames) {
+
+  if (frames != nullptr && num_frames > 0) {
+    _rx_batch = frames;
+    _rx_batch_size = num_frames;
+  } else {
+    _rx_batch = &_msg;
+    _rx_batch_size = 1;
+  }
+
+  _rx_batch_count = 0;
+  _rx_batch_index = 0;
+}
+
+//
+/// default implementation, reports one frame if any are available, so callers can only tell whether frames are waiting
+//
+
+unsigned int CBUSbase::pendingMessages(void) {
+
+  return available() ? 1 : 0;
+}
+
+//
+/// default implementation, retrieves up to max_msgs frames one at a time
+/// returns the number of frames placed in the caller's array
+//
+
+byte CBUSbase::getNextMessages(CANFrame *msgs, byte max_msgs) {
+
+  byte count = 0;
+
+  while (count < max_msgs && available()) {
+    msgs[count++] = getNextMessage();
+  }
+
+  return count;
+}
+
+//
+/// start bus enumeration if required, and handle the LEDs and switch
+//
+
+void CBUSbase::processUserInterface(void) {
+
   // start bus enumeration if required
   if (enumeration_required) {
     enumeration_required = false;
@@ -387,49 +1116,66 @@ void CBUSbase::process(byte num_messages) {
       }
     }
   }
+}
 
-  // get received CAN frames from buffer
-  // drain down the input buffer
-  // process up to 3 messages per run so the user's application code doesn't appear unresponsive under load
-
-  byte mcount = 0;
+//
+/// retrieve and process the next received frame, if any
+/// frames from the consume-own-events buffer are taken first
+/// received frames are retrieved from the driver in batches of up to max_fetch frames, limited by the size of the
+/// batch array, and processed in place
+/// returns false if no frame was available
+//
 
-  while ((available() || (coe_obj != nullptr && coe_obj->available())) && mcount < num_messages) {
+bool CBUSbase::processNextMessage(byte max_fetch) {
 
-    ++mcount;
+  CANFrame *msg;
 
-    // at least one CAN frame is available in either the reception buffer or the COE buffer
-    // retrieve the next one
+  // looped back frames are processed in place, and removed from the buffer afterwards
+  if (_loopback_head != _loopback_tail) {
+    msg = &_loopback[_loopback_tail & (_loopback_size - 1)];
+    _loopback_dispatch = true;
+  } else if (coe_obj != nullptr && coe_obj->available()) {
+    _msg = coe_obj->get();
+    msg = &_msg;
+  } else {
+    if (_rx_batch_index >= _rx_batch_count) {
+      _rx_batch_index = 0;
+      _rx_batch_count = getNextMessages(_rx_batch, (max_fetch < _rx_batch_size) ? max_fetch : _rx_batch_size);
 
-    if (coe_obj != nullptr && coe_obj->available()) {
-      _msg = coe_obj->get();
-    } else {
-      _msg = getNextMessage();
+      if (_rx_batch_count == 0) {
+        return false;
+      }
     }
 
-    //
-    /// if registered, call the user handler with this new frame
-    //
+    msg = &_rx_batch[_rx_batch_index++];
+  }
 
-    if (framehandler != nullptr) {
+  //
+  /// if registered, call the user handler with this new frame
+  //
 
-      // check if incoming opcode is in the user list, if list length > 0
-      if (_num_opcodes > 0) {
-        for (byte i = 0; i < _num_opcodes; i++) {
-          if (_msg.data[0] == _opcodes[i]) {
-            (void)(*framehandler)(&_msg);
-            break;
-          }
-        }
-      } else {
-        (void)(*framehandler)(&_msg);
-      }
-    }
+  // check if incoming opcode is in the user's opcode filter
+  if (framehandler != nullptr && bitRead(_opcode_filter[msg->data[0] >> 3], msg->data[0] & 0x07)) {
+    (void)(*framehandler)(msg);
+  }
+
+  // process just this message
+  process_single_message(msg);
 
-    // process just this message
-    process_single_message(&_msg);
+  if (_loopback_dispatch) {
+    _loopback_dispatch = false;
+    ++_loopback_tail;
   }
 
+  return true;
+}
+
+//
+/// check the CAN enumeration timer and the SLiM/FLiM negotiation timeout
+//
+
+void CBUSbase::processTimers(void) {
+
   // check CAN bus enumeration timer
   checkCANenum();
 
@@ -437,18 +1183,12 @@ void CBUSbase::process(byte num_messages) {
   /// check 30 sec timeout for SLiM/FLiM negotiation with FCU
   //
 
-  if (bModeChanging && ((millis() - timeOutTimer) >= 30000)) {
+  if (bModeChanging && ((CBUSClock::ms() - timeOutTimer) >= 30000)) {
 
     // DEBUG_SERIAL << F("> timeout expired, FLiM = ") << FLiM << F(", mode change = ") << bModeChanging << endl;
     indicateMode(module_config->FLiM);
     bModeChanging = false;
   }
-
-  // DEBUG_SERIAL << F("> end of opcode processing, time = ") << (micros() - mtime) << "us" << endl;
-
-  //
-  /// end of CBUS message processing
-  //
 }
 
 //
@@ -460,6 +1200,9 @@ void CBUSbase::process_single_message(CANFrame *msg) {
   byte remoteCANID, evindex, evval, opc;
   uint16_t nn, en;
 
+  // frames are processed in place, so the event handlers must be given this frame rather than _msg
+  _current_msg = msg;
+
   //
   /// pulse the green LED
   //
@@ -482,7 +1225,7 @@ void CBUSbase::process_single_message(CANFrame *msg) {
     // DEBUG_SERIAL << F("> CANID enumeration RTR from CANID = ") << remoteCANID << endl;
     // send an empty message to show our CANID
     msg->len = 0;
-    sendMessage(msg);
+    queueMessage(msg);
     return;
   }
 
@@ -512,7 +1255,7 @@ void CBUSbase::process_single_message(CANFrame *msg) {
     return;
   }
 
-  if (msg->len > 0 && remoteCANID == module_config->CANID && nn != module_config->nodeNum && !bCANenum) {
+  if (msg->len > 0 && remoteCANID == module_config->CANID && nn != module_config->nodeNum && !bCANenum && !_loopback_dispatch) {
     // DEBUG_SERIAL << F("> CAN id clash, enumeration required") << endl;
     enumeration_required = true;
   }
@@ -524,78 +1267,76 @@ void CBUSbase::process_single_message(CANFrame *msg) {
 
   if (msg->len > 0) {
 
-    byte index;
+    byte index, paran, nvindex, free_slots;
 
     // extract opcode and event/device number
     opc = msg->data[0];
     en = (msg->data[3] << 8) + msg->data[4];
 
-    switch (opc) {
+    //
+    /// classify the opcode and reject frames that are not handled, or not aimed at this node
+    /// in its current state, before any per-opcode work
+    //
 
-    case OPC_ACON:
-    case OPC_ACON1:
-    case OPC_ACON2:
-    case OPC_ACON3:
+    byte flags = pgm_read_byte(&opcode_table[opc]);
+    byte reject = 0;
 
-    case OPC_ACOF:
-    case OPC_ACOF1:
-    case OPC_ACOF2:
-    case OPC_ACOF3:
+    // call any handlers registered for this opcode, whether or not the library processes it
+    if (!msg->rtr && bitRead(_handler_opcodes[opc >> 3], opc & 0x07)) {
+      callOpcodeHandlers(msg);
+    }
 
-    case OPC_ARON:
-    case OPC_AROF:
+    if (nn != module_config->nodeNum) {
+      reject |= OPF_ADDRESSED;
+    }
 
-      // lookup this accessory event in the event table and call the user's registered callback function
-      if (eventhandler || eventhandlerex) {
-        _msg = *msg;
-        processAccessoryEvent(nn, en, (opc % 2 == 0));
-      }
+    if (!bLearn) {
+      reject |= OPF_LEARN;
+    }
 
-      break;
+    if (!bModeChanging) {
+      reject |= OPF_MODE_CHANGING;
+    }
 
-    case OPC_ASON:
-    case OPC_ASON1:
-    case OPC_ASON2:
-    case OPC_ASON3:
-
-    case OPC_ASOF:
-    case OPC_ASOF1:
-    case OPC_ASOF2:
-    case OPC_ASOF3:
-
-      // lookup this accessory event in the event table and call the user's registered callback function
-      // short events are stored with a node number of zero
-      if (eventhandler || eventhandlerex) {
-        _msg = *msg;
-        processAccessoryEvent(0, en, (opc % 2 == 0));
-      }
+    if (eventhandler == nullptr && eventhandlerex == nullptr && _event_queue == nullptr) {
+      reject |= OPF_ACC_EVENT;
+    }
 
-      break;
+    if (!(flags & OPF_HANDLED) || (flags & reject)) {
+      return;
+    }
 
-    case OPC_RQNP:
-      // RQNP message - request for node paramters -- does not contain a NN or EN, so only respond if we
-      // are in transition to FLiM
-      // DEBUG_SERIAL << F("> RQNP -- request for node params during FLiM transition for NN = ") << nn << endl;
+    // lookup accessory events in the event table and call the user's registered callback function
+    // short events are stored with a node number of zero
 
-      // only respond if we are in transition to FLiM mode
-      if (bModeChanging == true) {
+    if (flags & OPF_ACC_EVENT) {
+      processAccessoryEvent(((flags & OPF_SHORT_EVENT) ? 0 : nn), en, (opc % 2 == 0));
+      return;
+    }
 
-        // DEBUG_SERIAL << F("> responding to RQNP with PARAMS") << endl;
+    // node number, learn mode and mode changing checks have already been made using the opcode table
 
-        // respond with PARAMS message
-        msg->len = 8;
-        msg->data[0] = OPC_PARAMS;    // opcode
-        msg->data[1] = _mparams[1];     // manf code -- MERG
-        msg->data[2] = _mparams[2];     // minor code ver
-        msg->data[3] = _mparams[3];     // module ident
-        msg->data[4] = _mparams[4];     // number of events
-        msg->data[5] = _mparams[5];     // events vars per event
-        msg->data[6] = _mparams[6];     // number of NVs
-        msg->data[7] = _mparams[7];     // major code ver
-        // final param[8] = node flags is not sent here as the max message payload is 8 bytes (0-7)
-        sendMessage(msg);
+    switch (opc) {
 
-      }
+    case OPC_RQNP:
+      // RQNP message - request for node paramters -- does not contain a NN or EN, so only respond if we
+      // are in transition to FLiM, which the opcode table has checked
+      // DEBUG_SERIAL << F("> RQNP -- request for node params during FLiM transition for NN = ") << nn << endl;
+
+      // DEBUG_SERIAL << F("> responding to RQNP with PARAMS") << endl;
+
+      // respond with PARAMS message
+      msg->len = 8;
+      msg->data[0] = OPC_PARAMS;    // opcode
+      msg->data[1] = _mparams[1];     // manf code -- MERG
+      msg->data[2] = _mparams[2];     // minor code ver
+      msg->data[3] = _mparams[3];     // module ident
+      msg->data[4] = _mparams[4];     // number of events
+      msg->data[5] = _mparams[5];     // events vars per event
+      msg->data[6] = _mparams[6];     // number of NVs
+      msg->data[7] = _mparams[7];     // major code ver
+      // final param[8] = node flags is not sent here as the max message payload is 8 bytes (0-7)
+      queueMessage(msg);
 
       break;
 
@@ -604,28 +1345,25 @@ void CBUSbase::process_single_message(CANFrame *msg) {
       // index 0 = number of params available;
       // respond with PARAN
 
-      if (nn == module_config->nodeNum) {
+      paran = msg->data[3];
 
-        byte paran = msg->data[3];
+      // DEBUG_SERIAL << F("> RQNPN request for parameter # ") << paran << F(", from nn = ") << nn << endl;
 
-        // DEBUG_SERIAL << F("> RQNPN request for parameter # ") << paran << F(", from nn = ") << nn << endl;
+      if (paran <= _mparams[0]) {
 
-        if (paran <= _mparams[0]) {
+        paran = msg->data[3];
 
-          paran = msg->data[3];
-
-          msg->len = 5;
-          msg->data[0] = OPC_PARAN;
-          // msg->data[1] = highByte(module_config->nodeNum);
-          // msg->data[2] = lowByte(module_config->nodeNum);
-          msg->data[3] = paran;
-          msg->data[4] = _mparams[paran];
-          sendMessage(msg);
+        msg->len = 5;
+        msg->data[0] = OPC_PARAN;
+        // msg->data[1] = highByte(module_config->nodeNum);
+        // msg->data[2] = lowByte(module_config->nodeNum);
+        msg->data[3] = paran;
+        msg->data[4] = _mparams[paran];
+        queueMessage(msg);
 
-        } else {
-          // DEBUG_SERIAL << F("> RQNPN - param #") << paran << F(" is out of range !") << endl;
-          sendCMDERR(9);
-        }
+      } else {
+        // DEBUG_SERIAL << F("> RQNPN - param #") << paran << F(" is out of range !") << endl;
+        sendCMDERR(9);
       }
 
       break;
@@ -634,67 +1372,58 @@ void CBUSbase::process_single_message(CANFrame *msg) {
       // received SNN - set node number
       // DEBUG_SERIAL << F("> received SNN with NN = ") << nn << endl;
 
-      if (bModeChanging) {
-        // DEBUG_SERIAL << F("> buf[1] = ") << msg->data[1] << ", buf[2] = " << msg->data[2] << endl;
+      // DEBUG_SERIAL << F("> buf[1] = ") << msg->data[1] << ", buf[2] = " << msg->data[2] << endl;
 
-        // save the NN
-        // module_config->setNodeNum((msg->data[1] << 8) + msg->data[2]);
-        module_config->setNodeNum(nn);
+      // save the NN
+      // module_config->setNodeNum((msg->data[1] << 8) + msg->data[2]);
+      module_config->setNodeNum(nn);
 
-        // respond with NNACK
-        msg->len = 3;
-        msg->data[0] = OPC_NNACK;
-        // msg->data[1] = highByte(module_config->nodeNum);
-        // msg->data[2] = lowByte(module_config->nodeNum);
+      // respond with NNACK
+      msg->len = 3;
+      msg->data[0] = OPC_NNACK;
+      // msg->data[1] = highByte(module_config->nodeNum);
+      // msg->data[2] = lowByte(module_config->nodeNum);
 
-        sendMessage(msg);
+      queueMessage(msg);
 
-        // DEBUG_SERIAL << F("> sent NNACK for NN = ") << module_config->nodeNum << endl;
+      // DEBUG_SERIAL << F("> sent NNACK for NN = ") << module_config->nodeNum << endl;
 
-        // we are now in FLiM mode - update the configuration
-        bModeChanging = false;
-        module_config->setFLiM(true);
-        indicateMode(module_config->FLiM);
+      // we are now in FLiM mode - update the configuration
+      bModeChanging = false;
+      module_config->setFLiM(true);
+      indicateMode(module_config->FLiM);
 
-        // enumerate the CAN bus to allocate a free CAN ID
-        CANenumeration();
-
-        // DEBUG_SERIAL << F("> FLiM mode = ") << module_config->FLiM << F(", node number = ") << module_config->nodeNum << F(", CANID = ") << module_config->CANID << endl;
+      // enumerate the CAN bus to allocate a free CAN ID
+      CANenumeration();
 
-      } else {
-        // DEBUG_SERIAL << F("> received SNN but not in transition") << endl;
-      }
+      // DEBUG_SERIAL << F("> FLiM mode = ") << module_config->FLiM << F(", node number = ") << module_config->nodeNum << F(", CANID = ") << module_config->CANID << endl;
 
       break;
 
     case OPC_RQNN:
       // Another module has entered setup.
-      // If we are in setup, abort as only one module can be in setup
-
-      if (bModeChanging) {
-        bModeChanging = false;
-        indicateMode(module_config->FLiM);
-        // respond with NNACK
-        msg->len = 3;
-        msg->data[0] = OPC_NNACK;
-        msg->data[1] = highByte(module_config->nodeNum);
-        msg->data[2] = lowByte(module_config->nodeNum);
+      // We are in setup, so abort as only one module can be in setup
 
-        sendMessage(msg);
-      }
+      bModeChanging = false;
+      indicateMode(module_config->FLiM);
+      // respond with NNACK
+      msg->len = 3;
+      msg->data[0] = OPC_NNACK;
+      msg->data[1] = highByte(module_config->nodeNum);
+      msg->data[2] = lowByte(module_config->nodeNum);
+
+      queueMessage(msg);
       break;
 
     case OPC_CANID:
       // CAN -- set CANID
       // DEBUG_SERIAL << F("> CANID for nn = ") << nn << F(" with new CANID = ") << msg->data[3] << endl;
 
-      if (nn == module_config->nodeNum) {
-        // DEBUG_SERIAL << F("> setting my CANID to ") << msg->data[3] << endl;
-        if (msg->data[3] < 1 || msg->data[3] > 99) {
-          sendCMDERR(7);
-        } else {
-          module_config->setCANID(msg->data[3]);
-        }
+      // DEBUG_SERIAL << F("> setting my CANID to ") << msg->data[3] << endl;
+      if (msg->data[3] < 1 || msg->data[3] > 99) {
+        sendCMDERR(7);
+      } else {
+        module_config->setCANID(msg->data[3]);
       }
 
       break;
@@ -704,7 +1433,7 @@ void CBUSbase::process_single_message(CANFrame *msg) {
       // DEBUG_SERIAL << F("> ENUM message for nn = ") << nn << F(" from CANID = ") << remoteCANID << endl;
       // DEBUG_SERIAL << F("> my nn = ") << module_config->nodeNum << endl;
 
-      if (nn == module_config->nodeNum && remoteCANID != module_config->CANID && !bCANenum) {
+      if (remoteCANID != module_config->CANID && !bCANenum) {
         // DEBUG_SERIAL << F("> initiating enumeration") << endl;
         CANenumeration();
       }
@@ -713,20 +1442,17 @@ void CBUSbase::process_single_message(CANFrame *msg) {
 
     case OPC_NVRD:
       // received NVRD -- read NV by index
-      if (nn == module_config->nodeNum) {
-
-        byte nvindex = msg->data[3];
-        if (nvindex > module_config->EE_NUM_NVS) {
-          sendCMDERR(10);
-        } else {
-          // respond with NVANS
-          msg->len = 5;
-          msg->data[0] = OPC_NVANS;
-          // msg->data[1] = highByte(module_config->nodeNum);
-          // msg->data[2] = lowByte(module_config->nodeNum);
-          msg->data[4] = module_config->readNV(nvindex);
-          sendMessage(msg);
-        }
+      nvindex = msg->data[3];
+      if (nvindex > module_config->EE_NUM_NVS) {
+        sendCMDERR(10);
+      } else {
+        // respond with NVANS
+        msg->len = 5;
+        msg->data[0] = OPC_NVANS;
+        // msg->data[1] = highByte(module_config->nodeNum);
+        // msg->data[2] = lowByte(module_config->nodeNum);
+        msg->data[4] = module_config->readNV(nvindex);
+        queueMessage(msg);
       }
 
       break;
@@ -735,17 +1461,14 @@ void CBUSbase::process_single_message(CANFrame *msg) {
       // received NVSET -- set NV by index
       // DEBUG_SERIAL << F("> received NVSET for nn = ") << nn << endl;
 
-      if (nn == module_config->nodeNum) {
-
-        if (msg->data[3] > module_config->EE_NUM_NVS) {
-          sendCMDERR(10);
-        } else {
-          // update EEPROM for this NV -- NVs are indexed from 1, not zero
-          module_config->writeNV( msg->data[3], msg->data[4]);
-          // respond with WRACK
-          sendWRACK();
-          // DEBUG_SERIAL << F("> set NV ok") << endl;
-        }
+      if (msg->data[3] > module_config->EE_NUM_NVS) {
+        sendCMDERR(10);
+      } else {
+        // update EEPROM for this NV -- NVs are indexed from 1, not zero
+        module_config->writeNV( msg->data[3], msg->data[4]);
+        // respond with WRACK
+        sendWRACK();
+        // DEBUG_SERIAL << F("> set NV ok") << endl;
       }
 
       break;
@@ -754,12 +1477,10 @@ void CBUSbase::process_single_message(CANFrame *msg) {
       // received NNLRN -- place into learn mode
       // DEBUG_SERIAL << F("> NNLRN for node = ") << nn << F(", learn mode on") << endl;
 
-      if (nn == module_config->nodeNum) {
-        bLearn = true;
-        // DEBUG_SERIAL << F("> set lean mode ok") << endl;
-        // set bit 5 in parameter 8
-        bitSet(_mparams[8], 5);
-      }
+      bLearn = true;
+      // DEBUG_SERIAL << F("> set lean mode ok") << endl;
+      // set bit 5 in parameter 8
+      bitSet(_mparams[8], 5);
 
       break;
 
@@ -768,43 +1489,42 @@ void CBUSbase::process_single_message(CANFrame *msg) {
       // en = (msg->data[3] << 8) + msg->data[4];
       // DEBUG_SERIAL << F("> EVULN for nn = ") << nn << F(", en = ") << en << endl;
 
-      // we must be in learn mode
-      if (bLearn == true) {
+      // DEBUG_SERIAL << F("> searching for existing event to unlearn") << endl;
 
-        // DEBUG_SERIAL << F("> searching for existing event to unlearn") << endl;
+      // search for this NN and EN pair
+      index = module_config->findExistingEvent(nn, en);
 
-        // search for this NN and EN pair
-        index = module_config->findExistingEvent(nn, en);
+      if (index < module_config->EE_MAX_EVENTS) {
 
-        if (index < module_config->EE_MAX_EVENTS) {
+        // DEBUG_SERIAL << F("> deleting event at index = ") << index << F(", evs ") << endl;
+        module_config->cleareventEEPROM(index);
 
-          // DEBUG_SERIAL << F("> deleting event at index = ") << index << F(", evs ") << endl;
-          module_config->cleareventEEPROM(index);
+        // update hash table
+        module_config->updateEvHashEntry(index);
+        invalidateEventCacheEntry(nn, en);
+        setEventSlot(index, false);
 
-          // update hash table
-          module_config->updateEvHashEntry(index);
+        // bits cannot be removed from the filter, so rebuild it when next needed
+        _event_filter_valid = false;
 
-          // respond with WRACK
-          sendWRACK();
+        // respond with WRACK
+        sendWRACK();
 
-        } else {
-          // DEBUG_SERIAL << F("> did not find event to unlearn") << endl;
-          // respond with CMDERR
-          sendCMDERR(10);
-        }
-      } // if in learn mode
+      } else {
+        // DEBUG_SERIAL << F("> did not find event to unlearn") << endl;
+        // respond with CMDERR
+        sendCMDERR(10);
+      }
 
       break;
 
     case OPC_NNULN:
       // received NNULN -- exit from learn mode
 
-      if (nn == module_config->nodeNum) {
-        bLearn = false;
-        // DEBUG_SERIAL << F("> NNULN for node = ") << nn << F(", learn mode off") << endl;
-        // clear bit 5 in parameter 8
-        bitClear(_mparams[8], 5);
-      }
+      bLearn = false;
+      // DEBUG_SERIAL << F("> NNULN for node = ") << nn << F(", learn mode off") << endl;
+      // clear bit 5 in parameter 8
+      bitClear(_mparams[8], 5);
 
       break;
 
@@ -812,17 +1532,14 @@ void CBUSbase::process_single_message(CANFrame *msg) {
       // received RQEVN -- request for number of stored events
       // DEBUG_SERIAL << F("> RQEVN -- number of stored events for nn = ") << nn << endl;
 
-      if (nn == module_config->nodeNum) {
+      // respond with 0x74 NUMEV
+      msg->len = 4;
+      msg->data[0] = OPC_NUMEV;
+      // msg->data[1] = highByte(module_config->nodeNum);
+      // msg->data[2] = lowByte(module_config->nodeNum);
+      msg->data[3] = numStoredEvents();
 
-        // respond with 0x74 NUMEV
-        msg->len = 4;
-        msg->data[0] = OPC_NUMEV;
-        // msg->data[1] = highByte(module_config->nodeNum);
-        // msg->data[2] = lowByte(module_config->nodeNum);
-        msg->data[3] = module_config->numEvents();
-
-        sendMessage(msg);
-      }
+      queueMessage(msg);
 
       break;
 
@@ -830,29 +1547,9 @@ void CBUSbase::process_single_message(CANFrame *msg) {
       // request for all stored events
       // DEBUG_SERIAL << F("> NERD : request all stored events for nn = ") << nn << endl;
 
-      if (nn == module_config->nodeNum) {
-        msg->len = 8;
-        msg->data[0] = OPC_ENRSP;                       // response opcode
-        msg->data[1] = highByte(module_config->nodeNum);        // my NN hi
-        msg->data[2] = lowByte(module_config->nodeNum);         // my NN lo
-
-        for (byte i = 0; i < module_config->EE_MAX_EVENTS; i++) {
-
-          if (module_config->getEvTableEntry(i) != 0) {
-            // it's a valid stored event
-
-            // read the event data from EEPROM
-            // construct and send a ENRSP message
-            module_config->readEvent(i, &msg->data[3]);
-            msg->data[7] = i;                           // event table index
-
-            // DEBUG_SERIAL << F("> sending ENRSP reply for event index = ") << i << endl;
-            sendMessage(msg);
-            delay(10);
-
-          } // valid stored ev
-        } // loop each ev
-      } // for me
+      // the ENRSP replies are paced out by the responder, driven from process()
+      // a new request restarts any reply already in progress
+      startResponder(RESPONDER_NERD);
 
       break;
 
@@ -860,22 +1557,18 @@ void CBUSbase::process_single_message(CANFrame *msg) {
       // received REVAL -- request read of an event variable by event index and ev num
       // respond with NEVAL
 
-      if (nn == module_config->nodeNum) {
-
-        if (module_config->getEvTableEntry(msg->data[3]) != 0) {
+      if (module_config->getEvTableEntry(msg->data[3]) != 0) {
 
-          msg->len = 6;
-          msg->data[0] = OPC_NEVAL;
-          // msg->data[1] = highByte(module_config->nodeNum);
-          // msg->data[2] = lowByte(module_config->nodeNum);
-          msg->data[5] = module_config->getEventEVval(msg->data[3], msg->data[4]);
-          sendMessage(msg);
-        } else {
-
-          // DEBUG_SERIAL << F("> request for invalid event index") << endl;
-          sendCMDERR(6);
-        }
+        msg->len = 6;
+        msg->data[0] = OPC_NEVAL;
+        // msg->data[1] = highByte(module_config->nodeNum);
+        // msg->data[2] = lowByte(module_config->nodeNum);
+        msg->data[5] = module_config->getEventEVval(msg->data[3], msg->data[4]);
+        queueMessage(msg);
+      } else {
 
+        // DEBUG_SERIAL << F("> request for invalid event index") << endl;
+        sendCMDERR(6);
       }
 
       break;
@@ -883,46 +1576,42 @@ void CBUSbase::process_single_message(CANFrame *msg) {
     case OPC_NNCLR:
       // NNCLR -- clear all stored events
 
-      if (bLearn == true && nn == module_config->nodeNum) {
-
-        // DEBUG_SERIAL << F("> NNCLR -- clear all events") << endl;
+      // DEBUG_SERIAL << F("> NNCLR -- clear all events") << endl;
 
-        for (byte e = 0; e < module_config->EE_MAX_EVENTS; e++) {
-          module_config->cleareventEEPROM(e);
-        }
-
-        // recreate the hash table
-        module_config->clearEvHashTable();
-        // DEBUG_SERIAL << F("> cleared all events") << endl;
+      for (byte e = 0; e < module_config->EE_MAX_EVENTS; e++) {
+        module_config->cleareventEEPROM(e);
+      }
 
-        sendWRACK();
+      // recreate the hash table
+      module_config->clearEvHashTable();
+      clearEventCache();
+      if (_event_filter_mask != 0) {
+        memset(_event_filter, 0, (_event_filter_mask + 1) / 8);
       }
 
+      _event_filter_valid = true;
+      memset(_event_slots, 0, sizeof(_event_slots));
+      _num_stored_events = 0;
+      _event_slots_valid = true;
+      // DEBUG_SERIAL << F("> cleared all events") << endl;
+
+      sendWRACK();
+
       break;
 
     case OPC_NNEVN:
       // request for number of free event slots
 
-      if (module_config->nodeNum == nn) {
-
-        byte free_slots = 0;
+      free_slots = module_config->EE_MAX_EVENTS - numStoredEvents();
 
-        // count free slots using the event hash table
-        for (byte i = 0; i < module_config->EE_MAX_EVENTS; i++) {
-          if (module_config->getEvTableEntry(i) == 0) {
-            ++free_slots;
-          }
-        }
-
-        // DEBUG_SERIAL << F("> responding to to NNEVN with EVNLF, free event table slots = ") << free_slots << endl;
-        // memset(&_msg, 0, sizeof(_msg));
-        msg->len = 4;
-        msg->data[0] = OPC_EVNLF;
-        // msg->data[1] = highByte(module_config->nodeNum);
-        // msg->data[2] = lowByte(module_config->nodeNum);
-        msg->data[3] = free_slots;
-        sendMessage(msg);
-      }
+      // DEBUG_SERIAL << F("> responding to to NNEVN with EVNLF, free event table slots = ") << free_slots << endl;
+      // memset(&_msg, 0, sizeof(_msg));
+      msg->len = 4;
+      msg->data[0] = OPC_EVNLF;
+      // msg->data[1] = highByte(module_config->nodeNum);
+      // msg->data[2] = lowByte(module_config->nodeNum);
+      msg->data[3] = free_slots;
+      queueMessage(msg);
 
       break;
 
@@ -939,7 +1628,7 @@ void CBUSbase::process_single_message(CANFrame *msg) {
         msg->data[3] = _mparams[1];
         msg->data[4] = _mparams[3];
         msg->data[5] = _mparams[8];
-        sendMessage(msg);
+        queueMessage(msg);
       }
 
       break;
@@ -949,15 +1638,11 @@ void CBUSbase::process_single_message(CANFrame *msg) {
       // sent during module transition, so no node number check
       // DEBUG_SERIAL << F("> RQMN received") << endl;
 
-      // only respond if in transition to FLiM
-
       // respond with NAME
-      if (bModeChanging) {
-        msg->len = 8;
-        msg->data[0] = OPC_NAME;
-        memcpy(msg->data + 1, _mname, 7);
-        sendMessage(msg);
-      }
+      msg->len = 8;
+      msg->data[0] = OPC_NAME;
+      memcpy(msg->data + 1, _mname, 7);
+      queueMessage(msg);
 
       break;
 
@@ -968,67 +1653,57 @@ void CBUSbase::process_single_message(CANFrame *msg) {
 
       // DEBUG_SERIAL << endl << F("> EVLRN for source nn = ") << nn << F(", en = ") << en << F(", evindex = ") << evindex << F(", evval = ") << evval << endl;
 
-      // we must be in learn mode
-      if (bLearn == true) {
+      // search for this NN, EN as we may just be adding an EV to an existing learned event
+      // DEBUG_SERIAL << F("> searching for existing event to update") << endl;
+      index = module_config->findExistingEvent(nn, en);
 
-        // search for this NN, EN as we may just be adding an EV to an existing learned event
-        // DEBUG_SERIAL << F("> searching for existing event to update") << endl;
-        index = module_config->findExistingEvent(nn, en);
-
-        // not found - it's a new event
-        if (index >= module_config->EE_MAX_EVENTS) {
-          // DEBUG_SERIAL << F("> existing event not found - creating a new one if space available") << endl;
-          index = module_config->findEventSpace();
-        }
-
-        // if existing or new event space found, write the event data
+      // not found - it's a new event
+      if (index >= module_config->EE_MAX_EVENTS) {
+        // DEBUG_SERIAL << F("> existing event not found - creating a new one if space available") << endl;
+        index = module_config->findEventSpace();
+      }
 
-        if (index < module_config->EE_MAX_EVENTS) {
+      // if existing or new event space found, write the event data
 
-          // write the event to EEPROM at this location -- EVs are indexed from 1 but storage offsets start at zero !!
-          // DEBUG_SERIAL << F("> writing EV = ") << evindex << F(", at index = ") << index << F(", offset = ") << (module_config->EE_EVENTS_START + (index * module_config->EE_BYTES_PER_EVENT)) << endl;
+      if (index < module_config->EE_MAX_EVENTS) {
 
-          // don't repeat this for subsequent EVs
-          if (evindex < 2) {
-            module_config->writeEvent(index, &msg->data[1]);
+        // write the event to EEPROM at this location -- EVs are indexed from 1 but storage offsets start at zero !!
+        // DEBUG_SERIAL << F("> writing EV = ") << evindex << F(", at index = ") << index << F(", offset = ") << (module_config->EE_EVENTS_START + (index * module_config->EE_BYTES_PER_EVENT)) << endl;
 
-            // recreate event hash table entry
-            // DEBUG_SERIAL << F("> updating hash table entry for idx = ") << index << endl;
-            module_config->updateEvHashEntry(index);
-          }
+        // don't repeat this for subsequent EVs
+        if (evindex < 2) {
+          module_config->writeEvent(index, &msg->data[1]);
 
-          module_config->writeEventEV(index, evindex, evval);
+          // recreate event hash table entry
+          // DEBUG_SERIAL << F("> updating hash table entry for idx = ") << index << endl;
+          module_config->updateEvHashEntry(index);
+          addEventFilterEntry(nn, en);
+          setEventSlot(index, true);
+        }
 
-          // respond with WRACK
-          sendWRACK();
+        module_config->writeEventEV(index, evindex, evval);
+        invalidateEventCacheEntry(nn, en);
 
-        } else {
-          // DEBUG_SERIAL << F("> no free event storage, index = ") << index << endl;
-          // respond with CMDERR
-          sendCMDERR(10);
-        }
+        // respond with WRACK
+        sendWRACK();
 
-      } else { // bLearn == true
-        // DEBUG_SERIAL << F("> error -- not in learn mode") << endl;
+      } else {
+        // DEBUG_SERIAL << F("> no free event storage, index = ") << index << endl;
+        // respond with CMDERR
+        sendCMDERR(10);
       }
 
       break;
 
-    // case OPC_AREQ:
-    //   // AREQ message - request for node state, only producer nodes
-
-    //   if ((msg->data[1] == highByte(module_config->nodeNum)) && (msg->data[2] == lowByte(module_config->nodeNum))) {
-    //     (void)(*eventhandler)(0, &_msg);
-    //   }
-
-    //   break;
-
-    case OPC_BOOT:
-      // boot mode
+    case OPC_AREQ:
+      // AREQ message - request for the state of a long event produced by this node
+      // answered with ARON or AROF from the produced event states, if they have been set up
+      sendEventState(nn, en, false);
       break;
 
-    case OPC_RSTAT:
-      // command station status -- not applicable to accessory modules
+    case OPC_ASRQ:
+      // ASRQ message - request for the state of a short event, answered with ARSON or ARSOF by its producer
+      sendEventState(0, en, true);
       break;
 
     // case OPC_ARST:
@@ -1064,7 +1739,7 @@ void CBUSbase::checkCANenum(void) {
   byte selected_id = 1;     // default if no responses from other modules
 
   // if (bCANenum && !bCANenumComplete && (millis() - CANenumTime) >= 100) {
-  if (bCANenum && (millis() - CANenumTime) >= 100) {
+  if (bCANenum && (CBUSClock::ms() - CANenumTime) >= 100) {
 
     // enumeration timer has expired -- stop enumeration and process the responses
 
@@ -1118,96 +1793,532 @@ check_done:
     _msg.data[0] = OPC_NNACK;
     _msg.data[1] = highByte(module_config->nodeNum);
     _msg.data[2] = lowByte(module_config->nodeNum);
-    sendMessage(&_msg);
+    queueMessage(&_msg);
   }
 }
 
 //
 /// for accessory event messages, lookup the event in the event table and call the user's registered event handler function
+/// if an event cache has been set, hits skip the event table entirely
 //
 
 void CBUSbase::processAccessoryEvent(unsigned int nn, unsigned int en, bool is_on_event) {
 
-  // try to find a matching stored event -- match on nn, en
-  byte index = module_config->findExistingEvent(nn, en);
+  byte index, evval = 0;
+  event_cache_entry_t *entry = nullptr;
+
+  // most events are not ours, and the filter rejects them without touching the event table
+  if (_event_filter_mask != 0 && !eventFilterMayContain(nn, en)) {
+    ++_numEventFilterRejects;
+    return;
+  }
+
+  if (_event_cache != nullptr) {
+    entry = eventCacheEntry(nn, en);
+
+    if (entry->state != EVENT_CACHE_EMPTY && entry->nn == nn && entry->en == en) {
+      ++_numEventCacheHits;
+
+      if (entry->state == EVENT_CACHE_NOT_FOUND) {
+        return;
+      }
+
+      index = entry->index;
+      evval = entry->ev1;
+
+    } else {
+      ++_numEventCacheMisses;
+      entry->nn = nn;
+      entry->en = en;
+      entry->state = EVENT_CACHE_NOT_FOUND;
+      index = module_config->findExistingEvent(nn, en);
+
+      if (index < module_config->EE_MAX_EVENTS) {
+        evval = (module_config->EE_NUM_EVS > 0) ? module_config->getEventEVval(index, 1) : 0;
+        entry->index = index;
+        entry->ev1 = evval;
+        entry->state = EVENT_CACHE_FOUND;
+      }
+    }
+
+  } else {
+    // try to find a matching stored event -- match on nn, en
+    index = module_config->findExistingEvent(nn, en);
+
+    if (index < module_config->EE_MAX_EVENTS && (_event_queue != nullptr || (eventhandler == nullptr && eventhandlerex != nullptr)) && module_config->EE_NUM_EVS > 0) {
+      evval = module_config->getEventEVval(index, 1);
+    }
+  }
 
-  // call any registered event handler
+  // queue the event for the application if a queue has been set, otherwise call any registered event handler
 
-  if (index < module_config->EE_MAX_EVENTS) {
+  if (index < module_config->EE_MAX_EVENTS && _event_queue != nullptr) {
+    queueEvent(index, is_on_event, evval);
+  } else if (index < module_config->EE_MAX_EVENTS) {
     if (eventhandler != nullptr) {
-      (void)(*eventhandler)(index, &_msg);
+      (void)(*eventhandler)(index, _current_msg);
     } else if (eventhandlerex != nullptr) {
-      (void)(*eventhandlerex)(index, &_msg, is_on_event, \
-                              ((module_config->EE_NUM_EVS > 0) ? module_config->getEventEVval(index, 1) : 0) \
-                             );
+      (void)(*eventhandlerex)(index, _current_msg, is_on_event, evval);
     }
   }
 }
 
 //
-/// set the long message handler object to receive long message frames
+/// set a user-supplied array to be used as a deferred event queue, or nullptr to stop using one
+/// while a queue is set, matched events are queued rather than passed to the event handlers, and the application
+/// takes them with getNextEvent() at its own pace
+/// an event that is already waiting is updated with its latest state, so when the application falls behind it sees
+/// only the final state of each event; events that arrive when the queue is full are dropped and counted
+/// the optional pending array of pending_bytes bytes marks the events that are waiting, so that the queue is searched
+/// only for those; size it with EVENT_QUEUE_PENDING_BYTES(n) for an event table of n entries
+/// the queue is searched for every event without the array, and for events with indexes beyond its length
 //
 
-void CBUSbase::setLongMessageHandler(CBUSLongMessage *handler) {
-  longMessageHandler = handler;
+void CBUSbase::setEventQueue(consumed_event_t *entries, byte num_entries, byte *pending, byte pending_bytes) {
+
+  _event_queue = (num_entries > 0) ? entries : nullptr;
+  _event_queue_size = (_event_queue != nullptr) ? num_entries : 0;
+  _event_queue_pending = (_event_queue != nullptr && pending_bytes > 0) ? pending : nullptr;
+  _event_queue_pending_bits = (_event_queue_pending != nullptr) ? pending_bytes * 8 : 0;
+  _event_queue_head = 0;
+  _event_queue_count = 0;
+
+  if (_event_queue_pending != nullptr) {
+    memset(_event_queue_pending, 0, pending_bytes);
+  }
 }
 
-void CBUSbase::consumeOwnEvents(CBUScoe *coe) {
-  coe_obj = coe;
+void CBUSbase::queueEvent(byte index, bool is_on, byte evval) {
+
+  consumed_event_t *event;
+
+  if (index >= _event_queue_pending_bits || bitRead(_event_queue_pending[index >> 3], index & 7)) {
+    // possibly already waiting -- find it and update it in place
+    for (byte i = 0, slot = _event_queue_head; i < _event_queue_count; i++, slot = (slot + 1 == _event_queue_size) ? 0 : slot + 1) {
+      event = &_event_queue[slot];
+
+      if (event->index == index) {
+        event->is_on = is_on;
+        event->ev1 = evval;
+        event->time = CBUSClock::ms();
+        ++_numEventsCoalesced;
+        return;
+      }
+    }
+  }
+
+  if (_event_queue_count == _event_queue_size) {
+    ++_numEventsDropped;
+    return;
+  }
+
+  unsigned int tail = _event_queue_head + _event_queue_count;
+
+  if (tail >= _event_queue_size) {
+    tail -= _event_queue_size;
+  }
+
+  event = &_event_queue[tail];
+  event->index = index;
+  event->is_on = is_on;
+  event->ev1 = evval;
+  event->time = CBUSClock::ms();
+  ++_event_queue_count;
+
+  if (index < _event_queue_pending_bits) {
+    bitSet(_event_queue_pending[index >> 3], index & 7);
+  }
 }
 
 //
-/// utility method to populate a CBUS message header
+/// take the oldest waiting event from the deferred event queue
+/// returns false if there are none
 //
 
-void CBUSbase::makeHeader(CANFrame *msg, byte priority) {
+bool CBUSbase::getNextEvent(consumed_event_t *event) {
 
-  makeHeader_impl(msg, module_config->CANID, priority);
-  return;
+  if (_event_queue_count == 0) {
+    return false;
+  }
+
+  *event = _event_queue[_event_queue_head];
+
+  if (event->index < _event_queue_pending_bits) {
+    bitClear(_event_queue_pending[event->index >> 3], event->index & 7);
+  }
+
+  _event_queue_head = (_event_queue_head + 1 == _event_queue_size) ? 0 : _event_queue_head + 1;
+  --_event_queue_count;
+  return true;
+}
+
+byte CBUSbase::eventQueueCount(void) {
+
+  return _event_queue_count;
 }
 
 //
-/// actual implementation of the makeHeader method
-/// so it can be called directly or as a CBUS class method
-/// the 11 bit ID of a standard CAN frame is comprised of: (4 bits of CBUS priority) + (7 bits of CBUS CAN ID)
-/// priority = 1011 (0xB hex, 11 dec) as default argument, which translates to medium/low
+/// set a user-supplied array to be used as an event lookup cache, or nullptr to stop using one
+/// the cache is direct-mapped on a hash of (NN, EN) and is kept coherent when events are learned or unlearned
+/// using the CBUS opcodes; user code that changes the event table directly must call eventTableChanged()
 //
 
-void makeHeader_impl(CANFrame *msg, byte id, byte priority) {
+void CBUSbase::setEventCache(event_cache_entry_t *entries, byte num_entries) {
 
-  msg->id = (priority << 7) + (id & 0x7f);
-  return;
+  _event_cache = entries;
+  _event_cache_size = (entries != nullptr) ? num_entries : 0;
+
+  if (_event_cache_size == 0) {
+    _event_cache = nullptr;
+  }
+
+  clearEventCache();
+}
+
+void CBUSbase::clearEventCache(void) {
+
+  for (byte i = 0; i < _event_cache_size; i++) {
+    _event_cache[i].state = EVENT_CACHE_EMPTY;
+  }
+}
+
+//
+/// the cache slot for an event
+//
+
+event_cache_entry_t *CBUSbase::eventCacheEntry(unsigned int nn, unsigned int en) {
+
+  unsigned int hash = (nn << 5) ^ (nn >> 11) ^ en;
+  hash ^= (hash >> 7);
+
+  return &_event_cache[hash % _event_cache_size];
+}
+
+void CBUSbase::invalidateEventCacheEntry(unsigned int nn, unsigned int en) {
+
+  if (_event_cache != nullptr) {
+    eventCacheEntry(nn, en)->state = EVENT_CACHE_EMPTY;
+  }
+}
+
+//
+/// set user-supplied storage for the event pre-filter, a Bloom filter over the event table, or nullptr to disable it
+/// size the storage with EVENT_FILTER_BYTES(n) for an event table of n entries, which gives 8 bits per event;
+/// the filter uses the largest power of 2 bits that fits, up to 32768, and less than 8 bytes disables it
+/// it never rejects a learned event, but lets a small proportion of unlearned events through to the full lookup
+/// it is built from the event table when first needed and kept up to date when events are learned or unlearned
+/// using the CBUS opcodes; user code that changes the event table directly must call eventTableChanged()
+//
+
+void CBUSbase::setEventFilter(byte *storage, unsigned int num_bytes) {
+
+  _event_filter = storage;
+  _event_filter_mask = 0;
+  _event_filter_valid = false;
+
+  if (storage != nullptr && num_bytes >= 8) {
+    unsigned int bits = 64;
+
+    while (bits < 32768U && bits / 4 <= num_bytes) {
+      bits <<= 1;
+    }
+
+    _event_filter_mask = bits - 1;
+  }
+}
+
+//
+/// the filter uses two bit positions derived from a 16-bit hash of the event
+//
+
+static inline unsigned int eventFilterHash(unsigned int nn, unsigned int en) {
+
+  unsigned int hash = (nn * 31) ^ en;
+  return hash ^ (hash >> 7) ^ (hash << 3);
+}
+
+bool CBUSbase::eventFilterMayContain(unsigned int nn, unsigned int en) {
+
+  if (!_event_filter_valid) {
+    makeEventFilter();
+  }
+
+  unsigned int hash = eventFilterHash(nn, en);
+  unsigned int b1 = hash & _event_filter_mask;
+  unsigned int b2 = (hash >> 8 | hash << 8) & _event_filter_mask;
+
+  return (_event_filter[b1 >> 3] & (1 << (b1 & 7))) && (_event_filter[b2 >> 3] & (1 << (b2 & 7)));
+}
+
+void CBUSbase::addEventFilterEntry(unsigned int nn, unsigned int en) {
+
+  // an invalid filter will be rebuilt including this event
+  if (_event_filter_mask == 0 || !_event_filter_valid) {
+    return;
+  }
+
+  unsigned int hash = eventFilterHash(nn, en);
+  unsigned int b1 = hash & _event_filter_mask;
+  unsigned int b2 = (hash >> 8 | hash << 8) & _event_filter_mask;
+
+  _event_filter[b1 >> 3] |= (1 << (b1 & 7));
+  _event_filter[b2 >> 3] |= (1 << (b2 & 7));
+}
+
+//
+/// rebuild the filter from the event table, reading only the occupied slots
+//
+
+void CBUSbase::makeEventFilter(void) {
+
+  byte tarr[4];
+
+  memset(_event_filter, 0, (_event_filter_mask + 1) / 8);
+  _event_filter_valid = true;
+
+  for (byte i = nextEventSlot(0); i < module_config->EE_MAX_EVENTS; i = nextEventSlot(i + 1)) {
+    module_config->readEvent(i, tarr);
+    addEventFilterEntry((tarr[0] << 8) + tarr[1], (tarr[2] << 8) + tarr[3]);
+  }
+}
+
+//
+/// the map of occupied event table slots, built from the event hash table when first needed and then
+/// kept up to date when events are learned or unlearned using the CBUS opcodes
+//
+
+void CBUSbase::makeEventSlots(void) {
+
+  memset(_event_slots, 0, sizeof(_event_slots));
+  _num_stored_events = 0;
+
+  for (byte i = 0; i < module_config->EE_MAX_EVENTS; i++) {
+    if (module_config->getEvTableEntry(i) != 0) {
+      bitSet(_event_slots[i >> 3], i & 7);
+      ++_num_stored_events;
+    }
+  }
+
+  _event_slots_valid = true;
+}
+
+void CBUSbase::setEventSlot(byte index, bool occupied) {
+
+  if (!_event_slots_valid) {
+    // the map will be rebuilt including this change
+    return;
+  }
+
+  if (bitRead(_event_slots[index >> 3], index & 7) != occupied) {
+    bitWrite(_event_slots[index >> 3], index & 7, occupied);
+
+    if (occupied) {
+      ++_num_stored_events;
+    } else {
+      --_num_stored_events;
+    }
+  }
+}
+
+//
+/// the index of the first occupied slot at or after index, or EE_MAX_EVENTS if there are none
+//
+
+byte CBUSbase::nextEventSlot(byte index) {
+
+  if (!_event_slots_valid) {
+    makeEventSlots();
+  }
+
+  while (index < module_config->EE_MAX_EVENTS) {
+    byte bits = _event_slots[index >> 3] >> (index & 7);
+
+    if (bits != 0) {
+      index += __builtin_ctz(bits);
+      return (index < module_config->EE_MAX_EVENTS) ? index : module_config->EE_MAX_EVENTS;
+    }
+
+    // skip to the start of the next byte, taking care not to wrap past 255
+    if ((index | 7) == 0xff) {
+      break;
+    }
+
+    index = (index | 7) + 1;
+  }
+
+  return module_config->EE_MAX_EVENTS;
+}
+
+byte CBUSbase::numStoredEvents(void) {
+
+  if (!_event_slots_valid) {
+    makeEventSlots();
+  }
+
+  return _num_stored_events;
+}
+
+//
+/// user code that changes the event table other than through the CBUS opcodes must call this,
+/// so that the event cache, event filter and occupancy map are rebuilt from the event table
+//
+
+void CBUSbase::eventTableChanged(void) {
+
+  clearEventCache();
+  _event_filter_valid = false;
+  _event_slots_valid = false;
+}
+
+//
+/// multi-frame responder
+/// replies that consist of many frames are sent one frame at a time from process(), paced by RESPONDER_DELAY,
+/// so the module continues to handle other traffic while a configuration tool reads its tables
+//
+
+void CBUSbase::startResponder(byte type) {
+
+  _responder_type = type;
+  _responder_index = 0;
+  _responder_last_sent = CBUSClock::ms() - RESPONDER_DELAY;     // send the first frame without waiting
+}
+
+bool CBUSbase::isResponding(void) {
+
+  return (_responder_type != RESPONDER_IDLE);
+}
+
+void CBUSbase::cancelResponder(void) {
+
+  _responder_type = RESPONDER_IDLE;
+}
+
+//
+/// send the next frame of the reply in progress, if the pacing delay has expired
+/// a frame that cannot be sent is retried on the next call
+//
+
+void CBUSbase::processResponder(void) {
+
+  CANFrame frame;
+
+  if (_responder_type == RESPONDER_IDLE || (CBUSClock::ms() - _responder_last_sent) < RESPONDER_DELAY) {
+    return;
+  }
+
+  switch (_responder_type) {
+
+  case RESPONDER_NERD:
+    // send an ENRSP for the next valid stored event
+
+    _responder_index = nextEventSlot(_responder_index);
+
+    if (_responder_index >= module_config->EE_MAX_EVENTS) {
+      // all events have been sent
+      _responder_type = RESPONDER_IDLE;
+      break;
+    }
+
+    // read the event data from EEPROM
+    // construct and send a ENRSP message
+    frame.len = 8;
+    frame.data[0] = OPC_ENRSP;                                  // response opcode
+    frame.data[1] = highByte(module_config->nodeNum);           // my NN hi
+    frame.data[2] = lowByte(module_config->nodeNum);            // my NN lo
+    module_config->readEvent(_responder_index, &frame.data[3]);
+    frame.data[7] = _responder_index;                           // event table index
+
+    // DEBUG_SERIAL << F("> sending ENRSP reply for event index = ") << _responder_index << endl;
+    if (queueMessage(&frame)) {
+      _responder_last_sent = CBUSClock::ms();
+      ++_responder_index;
+    }
+
+    break;
+
+  default:
+    _responder_type = RESPONDER_IDLE;
+    break;
+  }
 }
 
 //
-/// consume own events class
+/// set the long message handler object to receive long message frames
 //
 
-CBUScoe::CBUScoe(const byte num_items) {
+void CBUSbase::setLongMessageHandler(CBUSLongMessage *handler) {
+  longMessageHandler = handler;
+}
 
-  coe_buff = new circular_buffer2(num_items);
+void CBUSbase::consumeOwnEvents(CBUScoeBase *coe) {
+  coe_obj = coe;
 }
 
-CBUScoe::~CBUScoe() {
+//
+/// process the accessory events sent by this module as if they had been received, or LOOPBACK_OFF to stop
+/// this replaces putting each sent event into a CBUScoe buffer, and covers every frame sent through queueMessage(),
+/// including events from sendEvent() and the transmit queue; frames passed straight to the driver's sendMessage()
+/// are not looped back
+/// each event is copied once, when sent, into a user-supplied array whose size is rounded down to a power of 2,
+/// as the sent frame belongs to the caller; it is then processed in place from that array
+//
+
+void CBUSbase::setLoopback(byte mode, CANFrame *frames, byte num_frames) {
+
+  byte size = 1;
 
-  free(coe_buff);
+  while (num_frames >= size * 2 && size < 128) {
+    size *= 2;
+  }
+
+  _loopback_mode = LOOPBACK_OFF;
+  _loopback = (frames != nullptr && num_frames > 0) ? frames : nullptr;
+  _loopback_size = (_loopback != nullptr) ? size : 0;
+  _loopback_head = _loopback_tail = 0;
+
+  if (_loopback != nullptr) {
+    _loopback_mode = mode;
+  }
 }
 
-void CBUScoe::put(const CANFrame *msg) {
+//
+/// keep a copy of a frame the driver has accepted, if it is an accessory event and loopback is on
+/// RTR, extended and zero-length frames are never looped back, and events sent while the array is full are dropped
+//
+
+void CBUSbase::loopbackFrame(const CANFrame *msg, bool rtr, bool ext) {
+
+  if (_loopback_mode == LOOPBACK_OFF || rtr || ext || msg->len == 0 || !(pgm_read_byte(&opcode_table[msg->data[0]]) & OPF_ACC_EVENT)) {
+    return;
+  }
 
-  coe_buff->put(msg);
+  if ((byte)(_loopback_head - _loopback_tail) < _loopback_size) {
+    _loopback[_loopback_head & (_loopback_size - 1)] = *msg;
+    ++_loopback_head;
+  }
 }
 
-bool CBUScoe::available(void) {
+//
+/// utility method to populate a CBUS message header
+//
+
+void CBUSbase::makeHeader(CANFrame *msg, byte priority) {
 
-  return coe_buff->available();
+  makeHeader_impl(msg, module_config->CANID, priority);
+  return;
 }
 
-CANFrame CBUScoe::get(void) {
+//
+/// actual implementation of the makeHeader method
+/// so it can be called directly or as a CBUS class method
+/// the 11 bit ID of a standard CAN frame is comprised of: (4 bits of CBUS priority) + (7 bits of CBUS CAN ID)
+/// priority = 1011 (0xB hex, 11 dec) as default argument, which translates to medium/low
+//
+
+void makeHeader_impl(CANFrame *msg, byte id, byte priority) {
 
-  CANFrame msg;
-  memcpy(&msg, coe_buff->get(), sizeof(CANFrame));
-  return msg;
+  msg->id = (priority << 7) + (id & 0x7f);
+  return;
 }
 
 ///
@@ -1247,7 +2358,7 @@ bool circular_buffer2::available(void) {
 void circular_buffer2::put(const CANFrame *item) {
 
   memcpy((CANFrame*)&_buffer[_head]._item, (const CANFrame *)item, sizeof(CANFrame));
-  _buffer[_head]._item_insert_time = micros();
+  _buffer[_head]._item_insert_time = CBUSClock::us();
 
   // if the buffer is full, this put will overwrite the oldest item
 
@@ -51,8 +51,35 @@
 #define DEFAULT_PRIORITY 0xB               // default CBUS messages priority. 1011 = 2|3 = normal/low
 #define LONG_MESSAGE_DEFAULT_DELAY 20      // delay in milliseconds between sending successive long message fragments
 #define LONG_MESSAGE_RECEIVE_TIMEOUT 5000  // timeout waiting for next long message packet
+#define LONG_MESSAGE_SEND_RETRIES 10       // attempts to send a long message fragment, one per fragment delay, before the message is abandoned
 #define NUM_EX_CONTEXTS 4                  // number of send and receive contexts for extended implementation = number of concurrent messages
 #define EX_BUFFER_LEN 64                   // size of extended send and receive buffers
+#define RESPONDER_DELAY 10                 // delay in milliseconds between successive frames of a multi-frame reply
+#define EVENT_FILTER_BYTES(n) eventFilterBytes(n)  // storage for an event pre-filter covering n event table entries
+#define TX_QUEUE_SIZE 4                    // number of outgoing frames held while the CAN controller is busy
+#define MAX_OPCODE_HANDLERS 4              // number of handlers that can be registered for opcodes or ranges of opcodes
+#define EVENT_QUEUE_PENDING_BYTES(n) (((n) + 7) / 8)  // storage needed to mark which of n event table entries are queued
+#define PRODUCED_STATE_BYTES(n) (4 * (((n) + 7) / 8))  // storage needed to record the state of n produced events, long and short
+#define ESCALATION_MAX_PRIORITY 0x4        // aged frames are not escalated beyond this priority. 0100 = 1|0 = above normal/high
+
+//
+/// clock source for all library timing
+/// defaults to the Arduino millis() and micros() functions, and may be replaced with another source,
+/// e.g. a virtual clock in a host harness, so that timing can be advanced deterministically
+//
+
+class CBUSClock {
+
+public:
+  static void setSource(unsigned long (*millis_fn)(void), unsigned long (*micros_fn)(void));
+  static void resetSource(void);
+  static unsigned long ms(void) { return (*_millis_fn)(); }
+  static unsigned long us(void) { return (*_micros_fn)(); }
+
+private:
+  static unsigned long (*_millis_fn)(void);
+  static unsigned long (*_micros_fn)(void);
+};
 
 //
 /// CBUS modes
@@ -64,6 +91,24 @@ enum {
   MODE_CHANGING = 2
 };
 
+//
+/// loopback modes, for modules that consume the events they send
+//
+
+enum {
+  LOOPBACK_OFF = 0,
+  LOOPBACK_EVENTS
+};
+
+//
+/// multi-frame responder states
+//
+
+enum {
+  RESPONDER_IDLE = 0,
+  RESPONDER_NERD
+};
+
 //
 /// CBUS long message status codes
 //
@@ -75,7 +120,10 @@ enum {
   CBUS_LONG_MESSAGE_TIMEOUT_ERROR,
   CBUS_LONG_MESSAGE_CRC_ERROR,
   CBUS_LONG_MESSAGE_TRUNCATED,
-  CBUS_LONG_MESSAGE_INTERNAL_ERROR
+  CBUS_LONG_MESSAGE_INTERNAL_ERROR,
+  CBUS_LONG_MESSAGE_SEND_PROGRESS,                  // the statuses below are reported to the sender
+  CBUS_LONG_MESSAGE_SEND_ERROR,
+  CBUS_LONG_MESSAGE_CANCELLED
 };
 
 //
@@ -92,6 +140,84 @@ public:
   uint8_t data[8] = {};
 };
 
+//
+/// circular buffer templates, which use CANFrame and CBUSClock defined above
+//
+
+#include <CBUSCircularBuffer.h>
+
+//
+/// event lookup cache entry, mapping a (NN, EN) pair to its event table index and first event variable
+/// negative lookups are cached too
+//
+
+enum {
+  EVENT_CACHE_EMPTY = 0,
+  EVENT_CACHE_FOUND,
+  EVENT_CACHE_NOT_FOUND
+};
+
+typedef struct _event_cache_entry_t {
+  unsigned int nn, en;
+  byte index, ev1, state;
+} event_cache_entry_t;
+
+//
+/// matched event held for the application in the deferred event queue
+//
+
+typedef struct _consumed_event_t {
+  unsigned long time;                               // time of the latest ON or OFF, in milliseconds
+  byte index;                                       // event table index
+  byte ev1;                                         // first event variable, or zero if there are none
+  bool is_on;                                       // latest state
+} consumed_event_t;
+
+//
+/// event waiting to be sent by the event producer
+//
+
+typedef struct _produced_event_t {
+  unsigned int en;                                  // event number, or device number for a short event
+  byte data[3];                                     // optional data bytes
+  byte data_len;
+  bool is_on, is_short;
+} produced_event_t;
+
+//
+/// handler registered for an opcode or a range of opcodes, with a user context pointer
+//
+
+typedef void (*opcode_handler_t)(CANFrame *msg, void *context);
+
+typedef struct _opcode_handler_entry_t {
+  opcode_handler_t handler;
+  void *context;
+  byte first_opcode, last_opcode;
+} opcode_handler_entry_t;
+
+//
+/// outgoing frame held in the transmit queue
+//
+
+typedef struct _tx_queue_entry_t {
+  CANFrame frame;
+  byte priority;                                    // the priority the frame was queued with
+  byte current_priority;                            // the priority after any escalation for age
+  bool rtr, ext;
+  unsigned long queued_at;                          // time the frame was queued, in milliseconds
+} tx_queue_entry_t;
+
+//
+/// result of a time-budgeted processing run
+//
+
+typedef struct _process_result_t {
+  unsigned int frames_processed;                    // number of frames processed in this run
+  unsigned int frames_pending;                      // frames known to be waiting, a lower bound unless the driver counts them (see pendingMessages)
+  unsigned long elapsed_us;                         // time used by this run, in microseconds
+} process_result_t;
+
 //
 /// an abstract class to encapsulate CAN bus and CBUS processing
 /// it must be implemented by a derived subclass
@@ -99,7 +225,7 @@ public:
 
 // forward references
 class CBUSLongMessage;
-class CBUScoe;
+class CBUScoeBase;
 
 class CBUSbase {
 
@@ -109,6 +235,8 @@ public:
 
   // these methods are pure virtual and must be implemented by the derived class
   // as a consequence, it is not possible to create an instance of this class
+  // sendMessage returns true once the CAN controller has accepted the frame, and false if it is busy, so that the
+  // frame can be held in the transmit queue; it calls the user's transmit handler, if set, for each frame it sends
 
 #ifdef ARDUINO_ARCH_RP2040
   virtual bool begin(bool poll = false, SPIClassRP2040 & spi = SPI) = 0;
@@ -121,8 +249,20 @@ public:
   virtual bool sendMessageNoUpdate(CANFrame *msg) = 0;
   virtual void reset(void) = 0;
 
+  // the default implementations of these methods use the pure virtual methods above
+  // the default pendingMessages only reports whether any frame is waiting, as 0 or 1;
+  // derived classes with a receive buffer should override it to return the exact number,
+  // and drivers with hardware FIFOs or DMA rings can override getNextMessages to hand over bursts of frames
+
+  virtual unsigned int pendingMessages(void);
+  virtual byte getNextMessages(CANFrame *msgs, byte max_msgs);
+  void setReceiveBatch(CANFrame *frames, byte num_frames);
+
   // implementations of these methods are provided in the base class
 
+  bool queueMessage(CANFrame *msg, bool rtr = false, bool ext = false, byte priority = DEFAULT_PRIORITY);
+  byte txQueueCount(void);
+  void setPriorityEscalation(unsigned int stage_ms, byte max_priority = ESCALATION_MAX_PRIORITY);
   bool sendWRACK(void);
   bool sendCMDERR(byte cerrno);
   void CANenumeration(void);
@@ -130,6 +270,7 @@ public:
   bool isExt(CANFrame *msg);
   bool isRTR(CANFrame *msg);
   void process(byte num_messages = 3);
+  unsigned int processFor(unsigned long budget_us, process_result_t *result = nullptr);
   void process_single_message(CANFrame *msg);
   void initFLiM(void);
   void revertSLiM(void);
@@ -144,36 +285,128 @@ public:
   void setEventHandler(void (*fptr)(byte index, CANFrame *msg));
   void setEventHandler(void (*fptr)(byte index, CANFrame *msg, bool ison, byte evval));
   void setFrameHandler(void (*fptr)(CANFrame *msg), byte *opcodes = NULL, byte num_opcodes = 0);
+  void addFrameHandlerOpcode(byte opcode);
+  void removeFrameHandlerOpcode(byte opcode);
+  void addFrameHandlerOpcodes(byte first_opcode, byte last_opcode);
+  void removeFrameHandlerOpcodes(byte first_opcode, byte last_opcode);
+  bool addOpcodeHandler(byte opcode, opcode_handler_t fptr, void *context = nullptr);
+  bool addOpcodeHandler(byte first_opcode, byte last_opcode, opcode_handler_t fptr, void *context = nullptr);
+  void removeOpcodeHandler(opcode_handler_t fptr, void *context = nullptr);
   void setTransmitHandler(void (*fptr)(CANFrame *msg));
+  bool sendEvent(unsigned int en, bool is_on, bool is_short = false, const byte *data = nullptr, byte data_len = 0);
+  void setEventProducer(produced_event_t *entries, byte num_entries);
+  void setEventRateLimit(byte burst, unsigned int interval_ms);
+  byte eventProducerCount(void);
+  void setProducedEventStates(byte *storage, unsigned int first_en, unsigned int num_events);
   void makeHeader(CANFrame *msg, byte priority = DEFAULT_PRIORITY);
   void processAccessoryEvent(unsigned int nn, unsigned int en, bool is_on_event);
+  void setEventCache(event_cache_entry_t *entries, byte num_entries);
+  void clearEventCache(void);
+  void setEventFilter(byte *storage, unsigned int num_bytes);
+  void setEventQueue(consumed_event_t *entries, byte num_entries, byte *pending = nullptr, byte pending_bytes = 0);
+  bool getNextEvent(consumed_event_t *event);
+  byte eventQueueCount(void);
+  void eventTableChanged(void);
+  byte numStoredEvents(void);
+
+  bool isResponding(void);
+  void cancelResponder(void);
 
   void setLongMessageHandler(CBUSLongMessage *handler);
-  void consumeOwnEvents(CBUScoe *coe);
+  void consumeOwnEvents(CBUScoeBase *coe);
+  void setLoopback(byte mode, CANFrame *frames = nullptr, byte num_frames = 0);
 
-  unsigned int _numMsgsSent, _numMsgsRcvd;
+  unsigned int _numMsgsSent = 0, _numMsgsRcvd = 0;
+  unsigned int _numEventCacheHits = 0, _numEventCacheMisses = 0;
+  unsigned int _numEventFilterRejects = 0;
+  unsigned int _numMsgsQueued = 0, _numMsgsDropped = 0;
+  unsigned int _numEventsCoalesced = 0, _numEventsDropped = 0;
+  unsigned int _numProducedEvents = 0, _numProducedCoalesced = 0, _numProducedDropped = 0;
 
 protected:                                          // protected members become private in derived classes
+  void processUserInterface(void);
+  void callOpcodeHandlers(CANFrame *msg);
+  void compactOpcodeHandlers(void);
+  bool processNextMessage(byte max_fetch = 255);
+  void processTimers(void);
+  void startResponder(byte type);
+  event_cache_entry_t *eventCacheEntry(unsigned int nn, unsigned int en);
+  void invalidateEventCacheEntry(unsigned int nn, unsigned int en);
+  bool eventFilterMayContain(unsigned int nn, unsigned int en);
+  void addEventFilterEntry(unsigned int nn, unsigned int en);
+  void makeEventFilter(void);
+  void makeEventSlots(void);
+  void queueEvent(byte index, bool is_on, byte evval);
+  void setEventSlot(byte index, bool occupied);
+  byte nextEventSlot(byte index);
+  void processResponder(void);
+  void processTxQueue(void);
+  void processProducer(void);
+  bool takeProducerToken(void);
+  bool sendProducedEvent(produced_event_t *event);
+  byte *producedEventState(unsigned int nn, unsigned int en, bool is_short, byte *bit);
+  void recordProducedEvent(unsigned int en, bool is_on, bool is_short);
+  bool sendEventState(unsigned int nn, unsigned int en, bool is_short);
+  void escalateTxQueue(void);
+  void loopbackFrame(const CANFrame *msg, bool rtr, bool ext);
+
   CANFrame _msg;
+  CANFrame *_current_msg = &_msg;                   // the frame being processed, passed to the event handlers
+  CANFrame *_rx_batch = &_msg;                      // frames received from the driver, processed in place
+  byte _rx_batch_size = 1, _rx_batch_count = 0, _rx_batch_index = 0;
   CBUSLED _ledGrn, _ledYlw;
   CBUSSwitch _sw;
   CBUSConfig *module_config;
   unsigned char *_mparams;
   unsigned char *_mname;
-  void (*eventhandler)(byte index, CANFrame *msg);
-  void (*eventhandlerex)(byte index, CANFrame *msg, bool evOn, byte evVal);
-  void (*framehandler)(CANFrame *msg);
-  void (*transmithandler)(CANFrame *msg);
-  byte *_opcodes;
-  byte _num_opcodes;
+  void (*eventhandler)(byte index, CANFrame *msg) = nullptr;
+  void (*eventhandlerex)(byte index, CANFrame *msg, bool evOn, byte evVal) = nullptr;
+  void (*framehandler)(CANFrame *msg) = nullptr;
+  void (*transmithandler)(CANFrame *msg) = nullptr;
+  byte _opcode_filter[32] = {};                     // 256 bit map of opcodes passed to the frame handler
+  opcode_handler_entry_t _opcode_handlers[MAX_OPCODE_HANDLERS];
+  byte _num_opcode_handlers = 0;
+  byte _handler_opcodes[32] = {};                   // 256 bit map of opcodes with at least one registered handler
+  bool _calling_opcode_handlers = false, _opcode_handler_removed = false;
   byte enum_responses[16];                          // 128 bits for storing CAN enumeration results
-  bool bModeChanging, bCANenum, bLearn;
-  unsigned long timeOutTimer, CANenumTime;
-  bool enumeration_required;
+  bool bModeChanging = false, bCANenum = false, bLearn = false;
+  unsigned long timeOutTimer = 0UL, CANenumTime = 0UL;
+  bool enumeration_required = false;
+  byte _responder_type = RESPONDER_IDLE, _responder_index = 0;  // multi-frame reply in progress, and the next event table index
+  unsigned long _responder_last_sent = 0UL;
+  event_cache_entry_t *_event_cache = nullptr;      // optional user-supplied event lookup cache
+  byte _event_cache_size = 0;
+  byte *_event_filter = nullptr;                    // optional user-supplied Bloom filter over the learned events
+  unsigned int _event_filter_mask = 0;              // number of filter bits in use - 1, or zero if the filter is disabled
+  bool _event_filter_valid = false;                 // false when the filter must be rebuilt from the event table
+  byte _event_slots[32];                            // 256 bit map of occupied event table slots
+  byte _num_stored_events = 0;
+  bool _event_slots_valid = false;                  // false when the map must be rebuilt from the event table
+  consumed_event_t *_event_queue = nullptr;         // optional user-supplied deferred event queue
+  byte _event_queue_size = 0, _event_queue_head = 0, _event_queue_count = 0;
+  byte *_event_queue_pending = nullptr;             // optional user-supplied bit map of event indexes waiting in the queue
+  unsigned int _event_queue_pending_bits = 0;       // number of event indexes covered by the bit map
+  produced_event_t *_producer_queue = nullptr;      // optional user-supplied queue of events waiting to be sent
+  byte _producer_size = 0, _producer_head = 0, _producer_count = 0;
+  byte _producer_burst = 0, _producer_tokens = 0;   // token bucket rate limit, unlimited if the burst is zero
+  unsigned int _producer_interval_ms = 0;
+  unsigned long _producer_refill_time = 0UL;
+  byte *_produced_states = nullptr;                 // optional user-supplied bitsets: known and on, for each long then each short produced event
+  unsigned int _produced_first_en = 0, _produced_num_events = 0;
+  unsigned int _produced_nn = 0;                    // node number of the long produced event states
+  tx_queue_entry_t _tx_queue[TX_QUEUE_SIZE];        // frames waiting to be sent, most urgent first
+  byte _tx_queue_count = 0;
+  unsigned int _escalation_stage_ms = 0;            // age at which each step of priority escalation happens, or zero for none
+  byte _escalation_max_priority = ESCALATION_MAX_PRIORITY;
   bool UI = false;
 
   CBUSLongMessage *longMessageHandler = nullptr;    // CBUS long message object to receive relevant frames
-  CBUScoe *coe_obj = nullptr;                       // consume-own-events
+  CBUScoeBase *coe_obj = nullptr;                   // consume-own-events
+  CANFrame *_loopback = nullptr;                    // optional user-supplied ring of sent frames waiting to be processed by this module
+  byte _loopback_size = 0;
+  byte _loopback_head = 0, _loopback_tail = 0;      // free-running indexes into the ring
+  byte _loopback_mode = LOOPBACK_OFF;
+  bool _loopback_dispatch = false;                  // true while a looped back frame is being processed
 };
 
 //
@@ -187,6 +420,7 @@ class CBUSLongMessage {
 public:
 
   CBUSLongMessage(CBUSbase *cbus_object_ptr);
+  virtual ~CBUSLongMessage() {}
   bool sendLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id, const byte priority = DEFAULT_PRIORITY);
   void subscribe(byte *stream_ids, const byte num_stream_ids, void *receive_buffer, const unsigned int receive_buffer_len, void (*messagehandler)(void *fragment, const unsigned int fragment_len, const byte stream_id, const byte status));
   bool process(void);
@@ -213,6 +447,15 @@ protected:
 
 //// extended support for multiple concurrent long messages
 
+//
+/// CRC16 of long messages, CCITT polynomial, calculated incrementally
+//
+
+uint16_t crc16_init(void);
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, uint16_t length);
+uint16_t crc16_final(uint16_t crc);
+uint16_t crc16(uint8_t *data_p, uint16_t length);
+
 // send and receive contexts
 
 typedef struct _receive_context_t {
@@ -220,17 +463,48 @@ typedef struct _receive_context_t {
   byte receive_stream_id, sender_canid;
   byte *buffer;
   unsigned int receive_buffer_index, incoming_bytes_received, incoming_message_length, expected_next_receive_sequence_num, incoming_message_crc;
+  uint16_t crc;                                     // CRC of the data received so far
   unsigned long last_fragment_received;
 } receive_context_t;
 
+// called with CBUS_LONG_MESSAGE_COMPLETE once the last fragment of a message has been sent, or with an error or
+// cancelled status if it is abandoned, after which the message buffer may be reused
+// optionally also called with CBUS_LONG_MESSAGE_SEND_PROGRESS after each data fragment
+// msg is the message as submitted and bytes_sent is the number of message bytes sent so far
+
+typedef void (*long_message_send_handler_t)(const void *msg, unsigned int bytes_sent, byte stream_id, byte status);
+
 typedef struct _send_context_t {
   bool in_use, is_current;
+  bool is_cancelled;                                // to be released and reported by the next call to process()
   byte send_stream_id, send_priority, msg_delay;
-  byte *buffer;
+  byte send_retries;                                // failed attempts to send the current fragment
+  byte *buffer;                                     // this context's block of the send buffer pool, if configured
+  const byte *data;                                 // the message being sent
+  const void *user_msg;                             // the message as submitted, reported to the send handler
+  long_message_send_handler_t sendhandler;
   unsigned int send_buffer_len, send_buffer_index, send_sequence_num, msg_crc;
   unsigned long last_fragment_sent, send_time;
 } send_context_t;
 
+// the event pre-filter size, 8 bits per event rounded up to a power of 2, and at least 64 bits
+
+constexpr unsigned int eventFilterBytes(unsigned int num_events, unsigned int bytes = 8) {
+  return (bytes >= num_events) ? bytes : eventFilterBytes(num_events, bytes * 2);
+}
+
+// the receive context index size, a power of two at least twice the number of receive contexts
+
+constexpr unsigned int longMessageIndexSlots(unsigned int num_receive_contexts, unsigned int slots = 4) {
+  return (slots >= num_receive_contexts * 2) ? slots : longMessageIndexSlots(num_receive_contexts, slots * 2);
+}
+
+// bytes of arena needed by CBUSLongMessageEx::allocateContextsBuffers(), including padding to align the contexts
+
+#define LONG_MESSAGE_ARENA_BYTES(num_receive, receive_len, num_send, send_len) \
+  (alignof(receive_context_t) - 1 + (num_receive) * sizeof(receive_context_t) + (num_send) * sizeof(send_context_t) + \
+   longMessageIndexSlots(num_receive) + (size_t)(num_receive) * (receive_len) + (size_t)(num_send) * (send_len))
+
 //
 /// a derived class to extend the base long message class to handle multiple concurrent messages, sending and receiving
 //
@@ -241,10 +515,13 @@ public:
 
   CBUSLongMessageEx(CBUSbase *cbus_object_ptr)
     : CBUSLongMessage(cbus_object_ptr) {}         // derived class constructor calls the base class constructor
+  ~CBUSLongMessageEx();
 
-  bool allocateContexts(byte num_receive_contexts, unsigned int receive_buffer_len, byte num_send_contexts);
-  bool allocateContextsBuffers(byte num_receive_contexts, unsigned int receive_buffer_len, byte num_send_contexts, unsigned int send_buffer_len);
-  bool sendLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id, const byte priority = DEFAULT_PRIORITY);
+  bool allocateContexts(byte num_receive_contexts, unsigned int receive_buffer_len, byte num_send_contexts, void *arena = nullptr, size_t arena_len = 0);
+  bool allocateContextsBuffers(byte num_receive_contexts, unsigned int receive_buffer_len, byte num_send_contexts, unsigned int send_buffer_len, void *arena = nullptr, size_t arena_len = 0);
+  void freeContexts(void);
+  bool sendLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id, const byte priority = DEFAULT_PRIORITY, long_message_send_handler_t sendhandler = nullptr);
+  bool sendLongMessageNoCopy(const void *msg, const unsigned int msg_len, const byte stream_id, const byte priority, long_message_send_handler_t sendhandler);
   bool process(void);
   void subscribe(byte *stream_ids, const byte num_stream_ids, void (*messagehandler)(void *msg, unsigned int msg_len, byte stream_id, byte status));
   virtual void processReceivedMessageFragment(const CANFrame *frame);
@@ -252,14 +529,32 @@ public:
   bool is_sending_stream(byte stream_id);
   void use_crc(bool use_crc);
   void set_sequential(bool state);
+  void set_progress(bool state);
+  bool cancel(byte stream_id);
 
 private:
 
+  bool submitMessage(const void *msg, const unsigned int msg_len, const byte stream_id, const byte priority, bool copy, long_message_send_handler_t sendhandler);
+  void releaseSendContext(byte context);
+  void notifySender(byte context, byte status);
+  unsigned int rxIndexHash(byte sender_canid, byte stream_id);
+  byte rxIndexFind(byte sender_canid, byte stream_id);
+  void rxIndexInsert(byte context);
+  void rxIndexRemove(byte context);
+  void releaseReceiveContext(byte context);
+  void setStreamFilter(const byte *stream_ids, const byte num_stream_ids);
+  bool inStreamFilter(const byte stream_id) { return _stream_filter[stream_id >> 3] & (1 << (stream_id & 7)); }
+
   bool _use_crc = false;
   bool _is_sequential = false;
-  byte current_send_context, _num_receive_contexts = NUM_EX_CONTEXTS, _num_send_contexts = NUM_EX_CONTEXTS;
-  receive_context_t **_receive_contexts = nullptr;
-  send_context_t **_send_contexts = nullptr;
+  bool _send_progress = false;
+  byte current_send_context = 0, _num_receive_contexts = 0, _num_send_contexts = 0;
+  byte *_arena = nullptr;                           // the arena, if we allocated it
+  receive_context_t *_receive_contexts = nullptr;
+  send_context_t *_send_contexts = nullptr;
+  byte *_rx_index = nullptr;                        // open addressed index of receive contexts in use, keyed on sender CANID and stream id
+  unsigned int _rx_index_mask = 0;
+  byte _stream_filter[32] = {};                     // one bit for each of the 256 stream ids we are subscribed to
 };
 
 //
@@ -302,23 +597,42 @@ private:
   buffer_entry2_t *_buffer;
 };
 
-// consume-own-events class
+// consume-own-events classes
+// CBUSbase uses the buffer through this interface, so that its size is not part of the CBUSbase type
 
-class CBUScoe {
+class CBUScoeBase {
 
 public:
-  CBUScoe(const byte num_items = 4);
-  ~CBUScoe();
-  void put(const CANFrame *msg);
-  CANFrame get(void);
-  bool available(void);
+  virtual ~CBUScoeBase() {}
+  virtual void put(const CANFrame *msg) = 0;
+  virtual CANFrame get(void) = 0;
+  virtual bool available(void) = 0;
+  virtual unsigned int size(void) = 0;
+};
+
+// a buffer of N frames, held inline so that no heap allocation is needed, and the oldest frame is overwritten when full
+
+template <unsigned int N>
+class CBUScoeBuffer : public CBUScoeBase {
+
+public:
+  void put(const CANFrame *msg) { _buffer.put(msg); }
+  CANFrame get(void) { CANFrame *msg = _buffer.get(); return (msg != nullptr) ? *msg : CANFrame(); }
+  bool available(void) { return _buffer.available(); }
+  unsigned int size(void) { return _buffer.size(); }
 
 private:
-  circular_buffer2 *coe_buff;
+  circular_buffer_static<CANFrame, N> _buffer;
+};
+
+// the default buffer of 4 frames
+
+class CBUScoe : public CBUScoeBuffer<4> {
 };
 
 //
 /// pin set class, to encapsulate a set of 8 IO pins
+/// the pins can be scanned as inputs, read as one bitmask and debounced together; pin number 255 is unused
 //
 
 class BoardIOPinSet {
@@ -331,8 +645,21 @@ public:
   byte operator [] (byte i) const {return pin_array[i];}
   byte& operator [] (byte i) {return pin_array[i];}
 
+  void beginInputs(bool pullup = true);
+  byte readInputs(void);
+  byte scan(void);
+  byte state(void) { return _state; }
+  byte scanAndSend(CBUSbase & cbus, unsigned int first_en, bool active_low = true);
+
 private:
   byte pin_array[8];
+  byte _used = 0;                                   // bit map of pins in use
+  byte _state = 0, _cnt0 = 0, _cnt1 = 0;            // debounced state, and two bit vertical counters for each pin
+#if defined(__AVR__)
+  volatile uint8_t *_port_regs[8];                  // input registers of the distinct ports used by the pins
+  byte _num_ports = 0;
+  byte _pin_port[8], _pin_mask[8];                  // for each pin, its port and bit within the port
+#endif
 };
 
 //
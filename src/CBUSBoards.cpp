@@ -1,6 +1,10 @@
 
 #include "CBUS.h"
 
+#if defined(ARDUINO_ARCH_RP2040)
+#include <hardware/structs/sio.h>
+#endif
+
 /// IO pin set class
 
 BoardIOPinSet::BoardIOPinSet() {
@@ -24,6 +28,119 @@ byte BoardIOPinSet::pin(byte pin_number) {
 	return (pin_number < 8) ? pin_array[pin_number] : 255;
 }
 
+/// configure the pins as inputs, and note the port registers to read where the board allows
+/// the debounced state starts as the current input state, so no changes are reported for the initial state
+
+void BoardIOPinSet::beginInputs(bool pullup) {
+
+	_used = 0;
+
+#if defined(__AVR__)
+	_num_ports = 0;
+#endif
+
+	for (byte i = 0; i < 8; i++) {
+		if (pin_array[i] == 255) {
+			continue;
+		}
+
+		pinMode(pin_array[i], pullup ? INPUT_PULLUP : INPUT);
+		bitSet(_used, i);
+
+#if defined(__AVR__)
+		volatile uint8_t *reg = portInputRegister(digitalPinToPort(pin_array[i]));
+		byte p = 0;
+
+		while (p < _num_ports && _port_regs[p] != reg) {
+			++p;
+		}
+
+		if (p == _num_ports) {
+			_port_regs[_num_ports++] = reg;
+		}
+
+		_pin_port[i] = p;
+		_pin_mask[i] = digitalPinToBitMask(pin_array[i]);
+#endif
+	}
+
+	_state = readInputs();
+	_cnt0 = _cnt1 = 0;
+}
+
+/// read all the pins as one bitmask, bit n being pin n, with unused pins reading as zero
+/// each distinct port is read once on AVR and RP2040, otherwise each pin is read with digitalRead()
+
+byte BoardIOPinSet::readInputs(void) {
+
+	byte bits = 0;
+
+#if defined(__AVR__)
+	byte port_values[8];
+
+	for (byte p = 0; p < _num_ports; p++) {
+		port_values[p] = *_port_regs[p];
+	}
+
+	for (byte i = 0; i < 8; i++) {
+		if (bitRead(_used, i) && (port_values[_pin_port[i]] & _pin_mask[i])) {
+			bitSet(bits, i);
+		}
+	}
+#elif defined(ARDUINO_ARCH_RP2040)
+	uint32_t all = sio_hw->gpio_in;
+
+	for (byte i = 0; i < 8; i++) {
+		if (bitRead(_used, i) && ((all >> pin_array[i]) & 1)) {
+			bitSet(bits, i);
+		}
+	}
+#else
+	for (byte i = 0; i < 8; i++) {
+		if (bitRead(_used, i) && digitalRead(pin_array[i]) == HIGH) {
+			bitSet(bits, i);
+		}
+	}
+#endif
+
+	return bits;
+}
+
+/// sample the inputs and debounce all 8 together, using a two bit vertical counter for each pin
+/// a pin's debounced state changes when it has differed from it for four successive scans
+/// call at a regular interval, e.g. every 5 ms; returns the bit map of pins whose debounced state changed
+
+byte BoardIOPinSet::scan(void) {
+
+	byte delta = readInputs() ^ _state;
+
+	// count scans where each pin differs from its debounced state, and reset the count where it does not
+	_cnt1 = (_cnt1 ^ _cnt0) & delta;
+	_cnt0 = ~_cnt0 & delta;
+
+	// pins whose count has wrapped to zero while still differing have changed
+	byte changed = delta & ~(_cnt0 | _cnt1);
+	_state ^= changed;
+
+	return changed;
+}
+
+/// scan the inputs, and produce an event for each changed pin: event number first_en + n for pin n
+/// with active low inputs, e.g. switches to ground with pullups, a low input produces an ON event
+/// returns the bit map of changed pins
+
+byte BoardIOPinSet::scanAndSend(CBUSbase & cbus, unsigned int first_en, bool active_low) {
+
+	byte changed = scan();
+
+	for (byte bits = changed; bits != 0; bits &= bits - 1) {
+		byte i = __builtin_ctz(bits);
+		cbus.sendEvent(first_en + i, bitRead(_state, i) != active_low);
+	}
+
+	return changed;
+}
+
 /// base class
 
 MainBoardBase::MainBoardBase() {
@@ -0,0 +1,242 @@
+/*
+
+  Copyright (C) CBUS library contributors 2026
+
+  This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+//
+/// circular buffer templates with storage held inline, so that no heap allocation is needed
+/// this file is included by CBUS.h, and should not be included directly
+//
+
+#pragma once
+
+#include <Arduino.h>
+
+#if !defined(__AVR__)
+#include <atomic>
+#endif
+
+//
+/// a lock-free single-producer, single-consumer circular buffer
+/// one context, e.g. a CAN receive interrupt or a second core, may call put() while another, e.g. process(),
+/// calls peek(), pop(), get() and clear(), without disabling interrupts
+/// the capacity must be a power of 2, and the head and tail are free-running indices masked on use
+/// unlike circular_buffer2, a put to a full buffer fails and is counted as an overflow, because only the
+/// consumer may move the tail
+/// the statistics are updated without locking and are only exact when read from the context that updates them
+//
+
+template <typename T, unsigned int N>
+class circular_buffer_spsc {
+
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "circular_buffer_spsc capacity must be a power of 2");
+
+#if defined(__AVR__)
+  // single byte loads and stores are atomic on AVR, so the indices are bytes and the capacity is limited
+  static_assert(N <= 128, "circular_buffer_spsc capacity is limited to 128 on AVR");
+  typedef byte index_t;
+#else
+  typedef unsigned int index_t;
+#endif
+
+public:
+  // producer side
+
+  bool put(const T *item) {
+
+    index_t head = load_relaxed(_head);
+    index_t used = (index_t)(head - load_acquire(_tail));
+
+    if (used >= N) {
+      ++_overflows;
+      return false;
+    }
+
+    _buffer[head & (N - 1)] = *item;
+    store_release(_head, (index_t)(head + 1));
+
+    ++used;
+    _hwm = (used > _hwm) ? used : _hwm;
+    ++_puts;
+    return true;
+  }
+
+  // consumer side
+
+  T *peek(void) {
+
+    index_t tail = load_relaxed(_tail);
+    return (load_acquire(_head) == tail) ? nullptr : &_buffer[tail & (N - 1)];
+  }
+
+  void pop(void) {
+
+    index_t tail = load_relaxed(_tail);
+
+    if (load_acquire(_head) != tail) {
+      store_release(_tail, (index_t)(tail + 1));
+      ++_gets;
+    }
+  }
+
+  bool get(T *item) {
+
+    T *p = peek();
+
+    if (p == nullptr) {
+      return false;
+    }
+
+    *item = *p;
+    pop();
+    return true;
+  }
+
+  void clear(void) { store_release(_tail, load_acquire(_head)); }
+
+  // either side
+
+  bool available(void) { return load_acquire(_head) != load_acquire(_tail); }
+  bool empty(void) { return !available(); }
+  bool full(void) { return size() >= N; }
+  unsigned int size(void) { return (index_t)(load_acquire(_head) - load_acquire(_tail)); }
+  unsigned int free_slots(void) { return N - size(); }
+  unsigned int capacity(void) { return N; }
+
+  // statistics
+
+  unsigned int puts(void) { return _puts; }
+  unsigned int gets(void) { return _gets; }
+  unsigned int hwm(void) { return _hwm; }
+  unsigned int overflows(void) { return _overflows; }
+
+private:
+#if defined(__AVR__)
+  // the compiler barrier keeps the buffer access on the correct side of the index update
+  static index_t load_relaxed(volatile index_t &i) { return i; }
+  static index_t load_acquire(volatile index_t &i) { index_t v = i; __asm__ __volatile__("" ::: "memory"); return v; }
+  static void store_release(volatile index_t &i, index_t v) { __asm__ __volatile__("" ::: "memory"); i = v; }
+
+  volatile index_t _head = 0, _tail = 0;
+#else
+  static index_t load_relaxed(std::atomic<index_t> &i) { return i.load(std::memory_order_relaxed); }
+  static index_t load_acquire(std::atomic<index_t> &i) { return i.load(std::memory_order_acquire); }
+  static void store_release(std::atomic<index_t> &i, index_t v) { i.store(v, std::memory_order_release); }
+
+  std::atomic<index_t> _head{0}, _tail{0};
+#endif
+
+  unsigned int _puts = 0, _gets = 0, _overflows = 0, _hwm = 0;
+  T _buffer[N];
+};
+
+//
+/// a circular buffer with its storage held inline, so it can be a global or a member without using the heap
+/// the interface matches circular_buffer2, including overwriting the oldest item when full, but the capacity
+/// is fixed at compile time and may be larger than 255
+/// as for circular_buffer2, it is not safe to put items from an interrupt context; see circular_buffer_spsc
+//
+
+template <bool small> struct circular_buffer_index { typedef unsigned int type; };
+template <> struct circular_buffer_index<true> { typedef byte type; };
+
+template <typename T, unsigned int N>
+class circular_buffer_static {
+
+  static_assert(N >= 1, "circular_buffer_static capacity must be at least 1");
+  typedef typename circular_buffer_index<(N <= 255)>::type index_t;
+
+public:
+  bool available(void) { return (_size > 0); }
+
+  void put(const T *item) {
+
+    _buffer[_head]._item = *item;
+    _buffer[_head]._item_insert_time = CBUSClock::us();
+
+    // if the buffer is full, this put will overwrite the oldest item
+    if (_size == N) {
+      _tail = next(_tail);
+      ++_overflows;
+    } else {
+      ++_size;
+      _hwm = (_size > _hwm) ? _size : _hwm;
+    }
+
+    _head = next(_head);
+    ++_puts;
+  }
+
+  T *peek(void) { return (_size == 0) ? nullptr : &_buffer[_tail]._item; }
+
+  T *get(void) {
+
+    T *p = peek();
+
+    if (p != nullptr) {
+      _tail = next(_tail);
+      --_size;
+      ++_gets;
+    }
+
+    return p;
+  }
+
+  // must be called before the item is removed by get()
+  unsigned long insert_time(void) { return _buffer[_tail]._item_insert_time; }
+
+  bool full(void) { return (_size == N); }
+  void clear(void) { _head = _tail = _size = 0; }
+  bool empty(void) { return (_size == 0); }
+  index_t size(void) { return _size; }
+  index_t free_slots(void) { return N - _size; }
+  unsigned int capacity(void) { return N; }
+  unsigned int puts(void) { return _puts; }
+  unsigned int gets(void) { return _gets; }
+  index_t hwm(void) { return _hwm; }
+  unsigned int overflows(void) { return _overflows; }
+
+private:
+  // the compiler reduces this to a mask when N is a power of 2
+  static index_t next(index_t i) { return (index_t)((i + 1) % N); }
+
+  struct entry_t {
+    unsigned long _item_insert_time;
+    T _item;
+  };
+
+  index_t _head = 0, _tail = 0, _size = 0, _hwm = 0;
+  unsigned int _puts = 0, _gets = 0, _overflows = 0;
+  entry_t _buffer[N];
+};
@@ -44,7 +44,6 @@
 #include <CBUS.h>
 #include <Streaming.h>
 
-uint16_t crc16(uint8_t *data_p, uint16_t length);
 uint32_t crc32(const char *s, size_t n);
 
 //
@@ -159,7 +158,7 @@ bool CBUSLongMessage::process(void) {
 
 	/// check receive timeout
 
-	if (_is_receiving && (millis() - _last_fragment_received >= _receive_timeout)) {
+	if (_is_receiving && (CBUSClock::ms() - _last_fragment_received >= _receive_timeout)) {
 		// DEBUG_SERIAL << F("> L: ERROR: timed out waiting for continuation fragment") << endl;
 		(void)(*_messagehandler)(_receive_buffer, _receive_buffer_index, _receive_stream_id, CBUS_LONG_MESSAGE_TIMEOUT_ERROR);
 		_is_receiving = false;
@@ -171,9 +170,9 @@ bool CBUSLongMessage::process(void) {
 
 	/// send the next outgoing fragment, after a configurable delay to avoid flooding the bus
 
-	if (_send_buffer_index < _send_buffer_len && (millis() - _last_fragment_sent >= _msg_delay)) {
+	if (_send_buffer_index < _send_buffer_len && (CBUSClock::ms() - _last_fragment_sent >= _msg_delay)) {
 
-		_last_fragment_sent = millis();
+		_last_fragment_sent = CBUSClock::ms();
 
 		memset(&frame.data, 0, sizeof(frame.data));
 		frame.data[1] = _send_stream_id;
@@ -207,7 +206,7 @@ void CBUSLongMessage::processReceivedMessageFragment(const CANFrame *frame) {
 
 	// DEBUG_SERIAL << F("> L: processing received long message fragment, message length = ") << _incoming_message_length << F(", rcvd so far = ") << _incoming_bytes_received << endl;
 
-	_last_fragment_received = millis();
+	_last_fragment_received = CBUSClock::ms();
 
 	byte i, j;
 
@@ -336,7 +335,7 @@ bool CBUSLongMessage::sendMessageFragment(CANFrame *frame, const byte priority)
 	frame->len = 8;
 	frame->data[0] = OPC_DTXC;
 
-	ret = (_cbus_object_ptr->sendMessage(frame, false, false, priority));
+	ret = (_cbus_object_ptr->queueMessage(frame, false, false, priority));
 
 	// sprintf(buffer, "[%lu] [%u] [ ", frame->id, frame->len);
 	// for (byte i = 0; i < frame->len; i++) {
@@ -383,84 +382,153 @@ void CBUSLongMessage::setTimeout(unsigned int timeout_in_millis) {
 
 //
 /// allocate memory for receive and send contexts
+/// each send context has a send buffer pool block of EX_BUFFER_LEN bytes, so sendLongMessage() can copy messages
+/// of up to that length; use allocateContextsBuffers() for longer messages
 //
 
-bool CBUSLongMessageEx::allocateContexts(byte num_receive_contexts, unsigned int receive_buffer_len, byte num_send_contexts) {
+bool CBUSLongMessageEx::allocateContexts(byte num_receive_contexts, unsigned int receive_buffer_len, byte num_send_contexts, void *arena, size_t arena_len) {
 
-	return allocateContextsBuffers(num_receive_contexts, receive_buffer_len, num_send_contexts, 0);
+	return allocateContextsBuffers(num_receive_contexts, receive_buffer_len, num_send_contexts, EX_BUFFER_LEN, arena, arena_len);
 }
 
-bool CBUSLongMessageEx::allocateContextsBuffers(byte num_receive_contexts, unsigned int receive_buffer_len, byte num_send_contexts, unsigned int send_buffer_len) {
+//
+/// the contexts, the receive context index and all the buffers are laid out in one arena
+/// either supplied by the caller, of at least LONG_MESSAGE_ARENA_BYTES() bytes, or taken with a single malloc
+/// so allocation either succeeds completely or leaves nothing allocated
+/// returns false if the caller's arena is smaller than LONG_MESSAGE_ARENA_BYTES() for these counts and lengths
+//
 
+static_assert(alignof(send_context_t) <= alignof(receive_context_t) && sizeof(receive_context_t) % alignof(send_context_t) == 0, "send contexts must be aligned when following the receive contexts");
 
-	byte i;
+bool CBUSLongMessageEx::allocateContextsBuffers(byte num_receive_contexts, unsigned int receive_buffer_len, byte num_send_contexts, unsigned int send_buffer_len, void *arena, size_t arena_len) {
 
-	_num_receive_contexts = num_receive_contexts;
-	_receive_buffer_len = receive_buffer_len;
-	_num_send_contexts = num_send_contexts;
-	_send_buffer_len = send_buffer_len;
+	byte i, *ptr;
+	size_t needed = LONG_MESSAGE_ARENA_BYTES(num_receive_contexts, receive_buffer_len, num_send_contexts, send_buffer_len);
 
-	// allocate receive contexts
-	if ((_receive_contexts = (receive_context_t **)malloc(sizeof(receive_context_t *) * _num_receive_contexts)) == NULL) {
-		return false;
-	}
+	// release any previous allocation
+	freeContexts();
 
-	for (i = 0; i < _num_receive_contexts; i++) {
-		if ((_receive_contexts[i] = (receive_context_t *)malloc(sizeof(receive_context_t))) == NULL) {
+	if (arena == nullptr) {
+		if ((_arena = (byte *)malloc(needed)) == NULL) {
 			return false;
 		}
 
-		if ((_receive_contexts[i]->buffer = (byte *)malloc(receive_buffer_len * sizeof(byte))) == NULL) {
-			return false;
-		}
+		arena = _arena;
 
-		_receive_contexts[i]->in_use = false;
-	}
-
-	// allocate send contexts - user code provides the buffer when sending
-	if ((_send_contexts = (send_context_t **)malloc(sizeof(send_context_t *) * _num_send_contexts)) == NULL) {
+	} else if (arena_len < needed) {
+		// VLOG("ERROR: arena len = %u is smaller than the %u bytes needed", arena_len, needed);
 		return false;
 	}
 
-	for (i = 0; i < _num_send_contexts; i++) {
-		if ((_send_contexts[i] = (send_context_t *)malloc(sizeof(send_context_t))) == NULL) {
-			return false;
-		}
+	// align the context arrays, the index and buffers are byte arrays and follow them
+	ptr = (byte *)arena;
+	ptr += (alignof(receive_context_t) - ((uintptr_t)ptr % alignof(receive_context_t))) % alignof(receive_context_t);
 
-		if (send_buffer_len > 0) {
-			if ((_send_contexts[i]->buffer = (byte *)malloc(send_buffer_len * sizeof(byte))) == NULL) {
-				return false;
-			}
-		}
+	_receive_contexts = (receive_context_t *)ptr;
+	ptr += num_receive_contexts * sizeof(receive_context_t);
+
+	_send_contexts = (send_context_t *)ptr;
+	ptr += num_send_contexts * sizeof(send_context_t);
+
+	// the receive context index is a power of two, at least twice the number of contexts, so a probe is short
+	// and always ends at an empty slot
+	_rx_index = ptr;
+	_rx_index_mask = longMessageIndexSlots(num_receive_contexts) - 1;
+	memset(_rx_index, 0, _rx_index_mask + 1);
+	ptr += _rx_index_mask + 1;
+
+	for (i = 0; i < num_receive_contexts; i++) {
+		memset(&_receive_contexts[i], 0, sizeof(receive_context_t));
+		_receive_contexts[i].buffer = ptr;
+		ptr += receive_buffer_len;
+	}
 
-		_send_contexts[i]->in_use = false;
-		_send_contexts[i]->is_current = false;
+	// without a send buffer length, user code provides the buffer when sending
+	for (i = 0; i < num_send_contexts; i++) {
+		memset(&_send_contexts[i], 0, sizeof(send_context_t));
+		_send_contexts[i].buffer = (send_buffer_len > 0) ? ptr : nullptr;
+		ptr += send_buffer_len;
 	}
 
+	_num_receive_contexts = num_receive_contexts;
+	_receive_buffer_len = receive_buffer_len;
+	_num_send_contexts = num_send_contexts;
+	_send_buffer_len = send_buffer_len;
+
 	current_send_context = 0;
-	_last_fragment_sent = millis();			// in any context
+	_last_fragment_sent = CBUSClock::ms();			// in any context
 
 	// VLOG("allocated send and receive contexts ok");
 	return true;
 }
 
+//
+/// release the contexts and buffers
+/// a caller-supplied arena may be reused once this returns
+//
+
+void CBUSLongMessageEx::freeContexts(void) {
+
+	// messages still in flight are reported as cancelled, so callers sending without a copy can reclaim their buffers
+	for (byte i = 0; i < _num_send_contexts; i++) {
+		if (_send_contexts[i].in_use) {
+			notifySender(i, CBUS_LONG_MESSAGE_CANCELLED);
+		}
+	}
+
+	free(_arena);
+
+	_arena = nullptr;
+	_receive_contexts = nullptr;
+	_send_contexts = nullptr;
+	_rx_index = nullptr;
+	_rx_index_mask = 0;
+	_num_receive_contexts = 0;
+	_num_send_contexts = 0;
+	_send_buffer_len = 0;
+	current_send_context = 0;
+	return;
+}
+
+CBUSLongMessageEx::~CBUSLongMessageEx() {
+
+	freeContexts();
+}
+
 //
 /// initiate sending of a long message
 /// this method sends the first message - the header fragment
 /// the remainder of the message is sent in fragments from the process() method
+/// the message is copied into this context's block of the send buffer pool, of EX_BUFFER_LEN bytes unless another
+/// send buffer length was given to allocateContextsBuffers(); longer messages are refused
+/// the optional send handler is called from process() when the message has been sent or abandoned
 //
 
-bool CBUSLongMessageEx::sendLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id, const byte priority) {
+bool CBUSLongMessageEx::sendLongMessage(const void *msg, const unsigned int msg_len, const byte stream_id, const byte priority, long_message_send_handler_t sendhandler) {
+
+	return submitMessage(msg, msg_len, stream_id, priority, true, sendhandler);
+}
+
+//
+/// send a long message without copying it
+/// the caller must not change the message until the send handler is called, once the last fragment has been sent
+//
+
+bool CBUSLongMessageEx::sendLongMessageNoCopy(const void *msg, const unsigned int msg_len, const byte stream_id, const byte priority, long_message_send_handler_t sendhandler) {
+
+	return submitMessage(msg, msg_len, stream_id, priority, false, sendhandler);
+}
+
+bool CBUSLongMessageEx::submitMessage(const void *msg, const unsigned int msg_len, const byte stream_id, const byte priority, bool copy, long_message_send_handler_t sendhandler) {
 
 	byte context, j;
-	CANFrame frame;
 
 	// VLOG("submitting message, stream = %u, len - %u", stream_id, msg_len);
 
 	// if interleaving, ensure we aren't already sending a message with this stream ID
 	if (!_is_sequential) {
 		for (context = 0; context < _num_send_contexts; context++) {
-			if (_send_contexts[context]->in_use && _send_contexts[context]->send_stream_id == stream_id) {
+			if (_send_contexts[context].in_use && _send_contexts[context].send_stream_id == stream_id) {
 				// VLOG("ERROR: already sending on stream = %u", stream_id);
 				return false;
 			}
@@ -469,7 +537,7 @@ bool CBUSLongMessageEx::sendLongMessage(const void *msg, const unsigned int msg_
 
 	// find a free send context
 	for (context = 0; context < _num_send_contexts; context++) {
-		if (!_send_contexts[context]->in_use) {
+		if (!_send_contexts[context].in_use) {
 			break;
 		}
 	}
@@ -482,25 +550,43 @@ bool CBUSLongMessageEx::sendLongMessage(const void *msg, const unsigned int msg_
 
 	// VLOG("using send context = %u", context);
 
+	// take the message data, before committing the context
+	if (!copy) {
+		_send_contexts[context].data = (const byte *)msg;														// the caller keeps ownership
+
+	} else {																											// copied into this context's block of the send buffer pool
+		if (msg_len > _send_buffer_len) {
+			// VLOG("ERROR: message len = %u is larger than the send buffer = %u", msg_len, _send_buffer_len);
+			return false;
+		}
+
+		memcpy(_send_contexts[context].buffer, msg, msg_len);														// copy in the message data
+		_send_contexts[context].data = _send_contexts[context].buffer;
+	}
+
+	_send_contexts[context].user_msg = msg;
+	_send_contexts[context].sendhandler = sendhandler;
+	_send_contexts[context].is_cancelled = false;
+
 	// initialise context
-	_send_contexts[context]->in_use = true;
+	_send_contexts[context].in_use = true;
 
 	// for sequential transmissions, determine if this new message is the current context
 	// we are current by default if no other contexts are current
 	// if we are not current, we will wait until the current message has been completely sent
 
 	if (_is_sequential) {
-		_send_contexts[context]->is_current = true;											// this message is current by default, unless ...
+		_send_contexts[context].is_current = true;											// this message is current by default, unless ...
 
 		// is another context current ?
 		for (j = 0; j < _num_send_contexts; j++) {
-			if (j != context && _send_contexts[j]->is_current) {						// another context is current
-				_send_contexts[context]->is_current = false;									// so this message is not
+			if (j != context && _send_contexts[j].is_current) {						// another context is current
+				_send_contexts[context].is_current = false;									// so this message is not
 				break;
 			}
 		}
 
-		if (_send_contexts[context]->is_current) {
+		if (_send_contexts[context].is_current) {
 			current_send_context = context;																	// this is the only active context so make it the next to run
 			// VLOG("this message is current and will transmit now");
 		} else {
@@ -512,7 +598,7 @@ bool CBUSLongMessageEx::sendLongMessage(const void *msg, const unsigned int msg_
 		byte num_in_use = 0;
 
 		for (j = 0; j < _num_send_contexts; j++) {
-			if (_send_contexts[j]->in_use) {
+			if (_send_contexts[j].in_use) {
 				++num_in_use;
 			}
 		}
@@ -523,30 +609,15 @@ bool CBUSLongMessageEx::sendLongMessage(const void *msg, const unsigned int msg_
 		}
 	}
 
-	if (_send_buffer_len > 0) {																					// if this context already has buffer space allocated
-		byte *ptr = (byte *) msg;
-		byte len = msg_len;
-
-		if (len > _send_buffer_len) {
-			len = _send_buffer_len;
-		}
-
-		// VLOG("using existing send buffer space, size = %u, msg len = %u", _send_buffer_len, len);
-		memcpy(_send_contexts[context]->buffer, ptr, len);								// copy in the message data
-
-	} else {
-		// VLOG("duplicating message content - must free later");
-		_send_contexts[context]->buffer = (byte *)strdup((char *)msg);		// make a copy the message in the send context, will free later
-	}
-
-	_send_contexts[context]->send_stream_id = stream_id;																			// stream ID
-	_send_contexts[context]->send_priority = priority;																				// CAN send priority
-	_send_contexts[context]->send_buffer_len = msg_len;																				// message length
-	_send_contexts[context]->send_buffer_index = 0;																						// current offset into data buffer
-	_send_contexts[context]->send_time = micros();																						// when this message was submitted, to ensure queued messages are sent in order
-	_send_contexts[context]->msg_crc = _use_crc ? crc16((uint8_t *)msg, msg_len) : 0;					// CRC
-	_send_contexts[context]->send_sequence_num = 0;																						// next fragmant to send is the header
-	_send_contexts[context]->last_fragment_sent = millis();																		// seed this value so message does not transmit immediately
+	_send_contexts[context].send_stream_id = stream_id;																			// stream ID
+	_send_contexts[context].send_priority = priority;																				// CAN send priority
+	_send_contexts[context].send_buffer_len = msg_len;																				// message length
+	_send_contexts[context].send_buffer_index = 0;																						// current offset into data buffer
+	_send_contexts[context].send_time = CBUSClock::us();																						// when this message was submitted, to ensure queued messages are sent in order
+	_send_contexts[context].msg_crc = _use_crc ? crc16((uint8_t *)msg, msg_len) : 0;					// CRC
+	_send_contexts[context].send_sequence_num = 0;																						// next fragmant to send is the header
+	_send_contexts[context].send_retries = 0;
+	_send_contexts[context].last_fragment_sent = CBUSClock::ms();																		// seed this value so message does not transmit immediately
 
 	// VLOG("message queued for transmission");
 	// VLOG("");
@@ -562,16 +633,36 @@ bool CBUSLongMessageEx::sendLongMessage(const void *msg, const unsigned int msg_
 bool CBUSLongMessageEx::process(void) {
 
 	bool ret = true;
-	byte i, j;
+	byte i, j, notify_context = _num_send_contexts, notify_status = CBUS_LONG_MESSAGE_COMPLETE;
 	CANFrame frame;
 
 	/// check receive timeout for each active context
 
 	for (i = 0; i < _num_receive_contexts; i++) {
-		if (_receive_contexts[i]->in_use && (millis() - _receive_contexts[i]->last_fragment_received >= _receive_timeout)) {
+		if (_receive_contexts[i].in_use && (CBUSClock::ms() - _receive_contexts[i].last_fragment_received >= _receive_timeout)) {
 			// VLOG("ERROR: tiemed out waiting for continuation fragment in context = %u, timeout = %u", i, _receive_timeout);
-			(void)(*_messagehandler)(_receive_contexts[i]->buffer, _receive_contexts[i]->receive_buffer_index, _receive_contexts[i]->receive_stream_id, CBUS_LONG_MESSAGE_TIMEOUT_ERROR);
-			_receive_contexts[i]->in_use = false;
+			(void)(*_messagehandler)(_receive_contexts[i].buffer, _receive_contexts[i].receive_buffer_index, _receive_contexts[i].receive_stream_id, CBUS_LONG_MESSAGE_TIMEOUT_ERROR);
+			releaseReceiveContext(i);
+		}
+	}
+
+	/// release any cancelled messages, before sending anything more from them
+
+	for (j = 0; j < _num_send_contexts; j++) {
+		if (_send_contexts[j].in_use && _send_contexts[j].is_cancelled) {
+			// VLOG("releasing cancelled context = %u", j);
+			releaseSendContext(j);
+			notifySender(j, CBUS_LONG_MESSAGE_CANCELLED);
+		}
+	}
+
+	// if interleaving, the round-robin must not stop at a released context
+	if (!_is_sequential && _num_send_contexts > 0 && !_send_contexts[current_send_context].in_use) {
+		for (j = 0; j < _num_send_contexts; j++) {
+			current_send_context = (current_send_context + 1) % _num_send_contexts;
+			if (_send_contexts[current_send_context].in_use) {
+				break;
+			}
 		}
 	}
 
@@ -581,7 +672,7 @@ bool CBUSLongMessageEx::process(void) {
 
 	if (_is_sequential) {
 		for (j = 0; j < _num_send_contexts; j++) {
-			if (_send_contexts[j]->in_use && _send_contexts[j]->is_current) {
+			if (_send_contexts[j].in_use && _send_contexts[j].is_current) {
 				current_send_context = j;
 				break;
 			}
@@ -590,37 +681,39 @@ bool CBUSLongMessageEx::process(void) {
 
 	/// process and send the next fragment of the selected context, after a configurable delay to avoid flooding the bus
 
-	if (_send_contexts[current_send_context]->in_use && (millis() - _send_contexts[current_send_context]->last_fragment_sent > _msg_delay) && (millis() - _last_fragment_sent > _msg_delay)) {
+	if (_num_send_contexts > 0 && _send_contexts[current_send_context].in_use && (CBUSClock::ms() - _send_contexts[current_send_context].last_fragment_sent > _msg_delay) && (CBUSClock::ms() - _last_fragment_sent > _msg_delay)) {
 
 		// VLOG("");
-		// VLOG("processing send context = %u, seq = %u, mode = %c", current_send_context, _send_contexts[current_send_context]->send_sequence_num, (_is_sequential ? 'S' : 'I'));
+		// VLOG("processing send context = %u, seq = %u, mode = %c", current_send_context, _send_contexts[current_send_context].send_sequence_num, (_is_sequential ? 'S' : 'I'));
+
+		unsigned int fragment_index = _send_contexts[current_send_context].send_buffer_index;					// where this fragment's payload starts, to retry it
 
 		memset(&frame.data, 0, sizeof(frame.data));																											// clear the CAN message
-		frame.data[1] = _send_contexts[current_send_context]->send_stream_id;														// the stream id
-		frame.data[2] = _send_contexts[current_send_context]->send_sequence_num;												// sequence number
+		frame.data[1] = _send_contexts[current_send_context].send_stream_id;														// the stream id
+		frame.data[2] = _send_contexts[current_send_context].send_sequence_num;												// sequence number
 
-		if (_send_contexts[current_send_context]->send_sequence_num == 0) {															// it's the header fragment
+		if (_send_contexts[current_send_context].send_sequence_num == 0) {															// it's the header fragment
 
-			// VLOG("sending header fragment for stream = %u", _send_contexts[current_send_context]->send_stream_id);
+			// VLOG("sending header fragment for stream = %u", _send_contexts[current_send_context].send_stream_id);
 
 			// send the first fragment which forms the message header containing metadata
-			frame.data[3] = highByte(_send_contexts[current_send_context]->send_buffer_len);						  // the message length
-			frame.data[4] = lowByte(_send_contexts[current_send_context]->send_buffer_len);
-			frame.data[5] = highByte(_send_contexts[current_send_context]->msg_crc);										  // CRC, or zero if not implemented
-			frame.data[6] = lowByte(_send_contexts[current_send_context]->msg_crc);
+			frame.data[3] = highByte(_send_contexts[current_send_context].send_buffer_len);						  // the message length
+			frame.data[4] = lowByte(_send_contexts[current_send_context].send_buffer_len);
+			frame.data[5] = highByte(_send_contexts[current_send_context].msg_crc);										  // CRC, or zero if not implemented
+			frame.data[6] = lowByte(_send_contexts[current_send_context].msg_crc);
 			frame.data[7] = 0;																																						// flags - 0 = standard data message
 
-			_send_contexts[current_send_context]->last_fragment_sent = millis();													// timestamp when this fragment was sent
+			_send_contexts[current_send_context].last_fragment_sent = CBUSClock::ms();													// timestamp when this fragment was sent
 
 		} else {																																												// it's a continuation fragment
 
-			// VLOG("sending continuation fragment for stream = %u", _send_contexts[current_send_context]->send_stream_id );
+			// VLOG("sending continuation fragment for stream = %u", _send_contexts[current_send_context].send_stream_id );
 
 			// only the final fragment is potentially less than 5 bytes long
-			for (i = 0; i < 5 && _send_contexts[current_send_context]->send_buffer_index < _send_contexts[current_send_context]->send_buffer_len; i++) {								// for up to 5 bytes of payload
-				frame.data[i + 3] = _send_contexts[current_send_context]->buffer[_send_contexts[current_send_context]->send_buffer_index];																// take the next byte
-				// VLOG("consumed data byte = %c", (char)_send_contexts[current_send_context]->buffer[_send_contexts[current_send_context]->send_buffer_index]);
-				++_send_contexts[current_send_context]->send_buffer_index;
+			for (i = 0; i < 5 && _send_contexts[current_send_context].send_buffer_index < _send_contexts[current_send_context].send_buffer_len; i++) {								// for up to 5 bytes of payload
+				frame.data[i + 3] = _send_contexts[current_send_context].data[_send_contexts[current_send_context].send_buffer_index];																// take the next byte
+				// VLOG("consumed data byte = %c", (char)_send_contexts[current_send_context].data[_send_contexts[current_send_context].send_buffer_index]);
+				++_send_contexts[current_send_context].send_buffer_index;
 			}
 
 			// VLOG("consumed %u data bytes for this fragment", i);
@@ -628,67 +721,54 @@ bool CBUSLongMessageEx::process(void) {
 
 		/// send the message fragment
 
-		ret = sendMessageFragment(&frame, _send_contexts[current_send_context]->send_priority);						// send the fragment
-		// VLOG("sent message fragment, seq = %u, ret = %u", _send_contexts[current_send_context]->send_sequence_num, ret);
-
-		/// release the context once message content is exhausted
+		ret = sendMessageFragment(&frame, _send_contexts[current_send_context].send_priority);						// send the fragment
+		// VLOG("sent message fragment, seq = %u, ret = %u", _send_contexts[current_send_context].send_sequence_num, ret);
 
-		if (_send_contexts[current_send_context]->send_buffer_index >= _send_contexts[current_send_context]->send_buffer_len) {
+		/// if the fragment could not be sent, retry the same fragment after the next delay, as the receiver cannot recover from
+		/// a missing fragment, and abandon the message after LONG_MESSAGE_SEND_RETRIES attempts
+		/// or release the context once message content is exhausted
 
-			// VLOG("clearing completed context = %u", current_send_context);
+		if (!ret) {
 
-			_send_contexts[current_send_context]->in_use = false;
-			_send_contexts[current_send_context]->is_current = false;
-			_send_contexts[current_send_context]->send_buffer_len = 0;
+			_send_contexts[current_send_context].send_buffer_index = fragment_index;
 
-			if (_send_buffer_len == 0) {
-				// VLOG("freeing buffer");
-				free(_send_contexts[current_send_context]->buffer);
+			if (++_send_contexts[current_send_context].send_retries >= LONG_MESSAGE_SEND_RETRIES) {
+				// VLOG("ERROR: unable to send fragment, abandoning context = %u", current_send_context);
+				notify_context = current_send_context;
+				notify_status = CBUS_LONG_MESSAGE_SEND_ERROR;
+				releaseSendContext(current_send_context);
 			}
 
-			/// if sending sequentially, find the oldest active context and make it current
-
-			if (_is_sequential) {
-				bool found_next_context = false;
-				byte next_context_idx = 0;
-				unsigned long oldest_time = 0xffffffff;
-
-				// VLOG("looking for next sequential context to activate");
-
-				for (j = 0; j < _num_send_contexts; j++) {
-					if (_send_contexts[j]->in_use && _send_contexts[j]->send_time < oldest_time) {
-						found_next_context = true;
-						next_context_idx = j;
-						oldest_time = _send_contexts[j]->send_time;
-						break;
-					}
-				}
+		} else if (_send_contexts[current_send_context].send_buffer_index >= _send_contexts[current_send_context].send_buffer_len) {
 
-				if (found_next_context) {
-					_send_contexts[next_context_idx]->is_current = true;
-					// VLOG("next sequential context = %u", next_context_idx);
-				} else {
-					// VLOG("no context to activate");
-				}
-			}
+			// VLOG("clearing completed context = %u", current_send_context);
+			notify_context = current_send_context;
+			notify_status = CBUS_LONG_MESSAGE_COMPLETE;
+			releaseSendContext(current_send_context);
 
 			// VLOG("** message sending complete, context released");
 
 		} else {
 
 			// sending is not complete, increment counters
-			++_send_contexts[current_send_context]->send_sequence_num;
-			_send_contexts[current_send_context]->last_fragment_sent = millis();				// this context
-			// VLOG("next sequence number for this context = %u", _send_contexts[current_send_context]->send_sequence_num);
+			++_send_contexts[current_send_context].send_sequence_num;
+			_send_contexts[current_send_context].send_retries = 0;
+			_send_contexts[current_send_context].last_fragment_sent = CBUSClock::ms();				// this context
+			// VLOG("next sequence number for this context = %u", _send_contexts[current_send_context].send_sequence_num);
+
+			if (_send_progress && _send_contexts[current_send_context].send_buffer_index > 0) {
+				notify_context = current_send_context;
+				notify_status = CBUS_LONG_MESSAGE_SEND_PROGRESS;
+			}
 		}
 
-		_last_fragment_sent = millis();																								// any context
+		_last_fragment_sent = CBUSClock::ms();																								// any context
 
 		// if interleaving, locate the next context to process by round-robin
 		if (!_is_sequential) {
 			for (j = 0; j < _num_send_contexts; j++) {
 				current_send_context = (current_send_context + 1) % _num_send_contexts;
-				if (_send_contexts[current_send_context]->in_use) {
+				if (_send_contexts[current_send_context].in_use) {
 					break;
 				}
 			}
@@ -697,23 +777,119 @@ bool CBUSLongMessageEx::process(void) {
 		}
 	}
 
+	/// tell the sender, once the contexts are settled, so it may send another message from the handler
+
+	if (notify_context < _num_send_contexts) {
+		notifySender(notify_context, notify_status);
+	}
+
 	return ret;
 }
 
+//
+/// release a send context, making the oldest waiting message current if sending sequentially
+//
+
+void CBUSLongMessageEx::releaseSendContext(byte context) {
+
+	bool was_current = _send_contexts[context].is_current;
+
+	_send_contexts[context].in_use = false;
+	_send_contexts[context].is_current = false;
+	_send_contexts[context].is_cancelled = false;
+	_send_contexts[context].send_buffer_len = 0;
+
+	/// if sending sequentially, find the oldest active context and make it current
+
+	if (_is_sequential && was_current) {
+		bool found_next_context = false;
+		byte next_context_idx = 0;
+		unsigned long oldest_time = 0xffffffff;
+
+		// VLOG("looking for next sequential context to activate");
+
+		for (byte j = 0; j < _num_send_contexts; j++) {
+			if (_send_contexts[j].in_use && _send_contexts[j].send_time < oldest_time) {
+				found_next_context = true;
+				next_context_idx = j;
+				oldest_time = _send_contexts[j].send_time;
+				break;
+			}
+		}
+
+		if (found_next_context) {
+			_send_contexts[next_context_idx].is_current = true;
+			// VLOG("next sequential context = %u", next_context_idx);
+		} else {
+			// VLOG("no context to activate");
+		}
+	}
+
+	return;
+}
+
+//
+/// report the state of a message to its sender, if a send handler was given
+/// the context may already have been released, which leaves the fields reported here untouched
+//
+
+void CBUSLongMessageEx::notifySender(byte context, byte status) {
+
+	if (_send_contexts[context].sendhandler != nullptr) {
+		(*_send_contexts[context].sendhandler)(_send_contexts[context].user_msg, _send_contexts[context].send_buffer_index, _send_contexts[context].send_stream_id, status);
+	}
+
+	return;
+}
+
+//
+/// cancel sending of any messages with this stream id
+/// the messages are released, and their send handlers called, by the next call to process()
+//
+
+bool CBUSLongMessageEx::cancel(byte stream_id) {
+
+	bool found = false;
+
+	for (byte i = 0; i < _num_send_contexts; i++) {
+		if (_send_contexts[i].in_use && _send_contexts[i].send_stream_id == stream_id) {
+			_send_contexts[i].is_cancelled = true;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
 //
 /// subscribe to a range of stream IDs
 //
 
 void CBUSLongMessageEx::subscribe(byte *stream_ids, const byte num_stream_ids, void (*messagehandler)(void *msg, unsigned int msg_len, byte stream_id, byte status)) {
 
-	_stream_ids = stream_ids;
-	_num_stream_ids = num_stream_ids;
+	setStreamFilter(stream_ids, num_stream_ids);
 	_messagehandler = messagehandler;
 
 	// DEBUG_SERIAL << F("> Lex: subscribe: num_stream_ids = ") << num_stream_ids << endl;
 	return;
 }
 
+//
+/// build the subscription bitmap from the list of stream IDs, so a received header fragment is checked in constant time
+/// subscribe again if the list is changed
+//
+
+void CBUSLongMessageEx::setStreamFilter(const byte *stream_ids, const byte num_stream_ids) {
+
+	memset(_stream_filter, 0, sizeof(_stream_filter));
+
+	for (byte i = 0; i < num_stream_ids; i++) {
+		_stream_filter[stream_ids[i] >> 3] |= (1 << (stream_ids[i] & 7));
+	}
+
+	return;
+}
+
 //
 /// report state of long message sending
 //
@@ -725,7 +901,7 @@ byte CBUSLongMessageEx::is_sending(void) {
 	byte i, num_streams;
 
 	for (i = 0, num_streams = 0; i < _num_send_contexts; i++) {
-		if (_send_contexts[i]->in_use) {
+		if (_send_contexts[i].in_use) {
 			++num_streams;
 		}
 	}
@@ -738,7 +914,7 @@ byte CBUSLongMessageEx::is_sending(void) {
 bool CBUSLongMessageEx::is_sending_stream(byte stream_id) {
 
 	for (byte i = 0; i < _num_send_contexts; i++) {
-		if (_send_contexts[i]->send_stream_id == stream_id && _send_contexts[i]->in_use) {
+		if (_send_contexts[i].send_stream_id == stream_id && _send_contexts[i].in_use) {
 			return true;
 		}
 	}
@@ -763,37 +939,42 @@ void CBUSLongMessageEx::processReceivedMessageFragment(const CANFrame *frame) {
 
 			// DEBUG_SERIAL << F("> Lex: this is a data message header fragment") << endl;
 
-			for (i = 0; i < _num_stream_ids; i++) {
-				if (_stream_ids[i] == frame->data[1]) {																				// are we subscribed to this stream id ?
+			if (inStreamFilter(frame->data[1])) {																				// are we subscribed to this stream id ?
 
-					// DEBUG_SERIAL << F("> Lex: we are subscribed to this stream ID = ") << frame->data[1] << endl;
+				// DEBUG_SERIAL << F("> Lex: we are subscribed to this stream ID = ") << frame->data[1] << endl;
 
-					// find a free receive context
+				// a sender restarting a message on the same stream reuses its context, otherwise find a free receive context
+				i = rxIndexFind(frame->id & 0x7f, frame->data[1]);
+
+				if (i >= _num_receive_contexts) {
 					for (i = 0; i < _num_receive_contexts; i++) {
-						if (!_receive_contexts[i]->in_use) {
+						if (!_receive_contexts[i].in_use) {
 							// DEBUG_SERIAL << F("> Lex: using receive context = ") << i << endl;
 							break;
 						}
 					}
 
 					if (i < _num_receive_contexts) {
-						_receive_contexts[i]->in_use = true;
-						_receive_contexts[i]->receive_stream_id = frame->data[1];
-						_receive_contexts[i]->incoming_message_length = (frame->data[3] << 8) + frame->data[4];
-						_receive_contexts[i]->incoming_message_crc = (frame->data[5] << 8) + frame->data[6];
-						_receive_contexts[i]->incoming_bytes_received = 0;
-						memset(_receive_contexts[i]->buffer, 0, _receive_buffer_len);
-						_receive_contexts[i]->receive_buffer_index = 0;
-						_receive_contexts[i]->expected_next_receive_sequence_num = 1;
-						_receive_contexts[i]->sender_canid = (frame->id & 0x7f);
-						_receive_contexts[i]->last_fragment_received = millis();
-						// DEBUG_SERIAL << F("> Lex: received header fragment for stream id = ") << _receive_contexts[i]->receive_stream_id << F(", message length = ") << _receive_contexts[i]->incoming_message_length << endl;
-					} else {
-						// DEBUG_SERIAL << F("> Lex: unable to find free receive context for new message") << endl;
-						(void)(*_messagehandler)(nullptr, 0, frame->data[1], CBUS_LONG_MESSAGE_INTERNAL_ERROR);
+						_receive_contexts[i].in_use = true;
+						_receive_contexts[i].receive_stream_id = frame->data[1];
+						_receive_contexts[i].sender_canid = (frame->id & 0x7f);
+						rxIndexInsert(i);
 					}
+				}
 
-					break;
+				if (i < _num_receive_contexts) {
+					_receive_contexts[i].incoming_message_length = (frame->data[3] << 8) + frame->data[4];
+					_receive_contexts[i].incoming_message_crc = (frame->data[5] << 8) + frame->data[6];
+					_receive_contexts[i].crc = crc16_init();
+					_receive_contexts[i].incoming_bytes_received = 0;
+					memset(_receive_contexts[i].buffer, 0, _receive_buffer_len);
+					_receive_contexts[i].receive_buffer_index = 0;
+					_receive_contexts[i].expected_next_receive_sequence_num = 1;
+					_receive_contexts[i].last_fragment_received = CBUSClock::ms();
+					// DEBUG_SERIAL << F("> Lex: received header fragment for stream id = ") << _receive_contexts[i].receive_stream_id << F(", message length = ") << _receive_contexts[i].incoming_message_length << endl;
+				} else {
+					// DEBUG_SERIAL << F("> Lex: unable to find free receive context for new message") << endl;
+					(void)(*_messagehandler)(nullptr, 0, frame->data[1], CBUS_LONG_MESSAGE_INTERNAL_ERROR);
 				}
 			}
 		} else {
@@ -804,12 +985,7 @@ void CBUSLongMessageEx::processReceivedMessageFragment(const CANFrame *frame) {
 		// DEBUG_SERIAL << F("> Lex: this is a continuation fragment") << endl;
 
 		// find a matching receive context, using the stream ID and sender CANID
-		for (i = 0; i < _num_receive_contexts; i++) {
-			if (_receive_contexts[i]->in_use && _receive_contexts[i]->receive_stream_id == frame->data[1] && _receive_contexts[i]->sender_canid == (frame->id & 0x7f)) {
-				// DEBUG_SERIAL << F("> Lex: found matching receive context = ") << i << endl;
-				break;
-			}
-		}
+		i = rxIndexFind(frame->id & 0x7f, frame->data[1]);
 
 		// return if not found
 		if (i >= _num_receive_contexts) {
@@ -818,54 +994,136 @@ void CBUSLongMessageEx::processReceivedMessageFragment(const CANFrame *frame) {
 		}
 
 		// error if out of sequence
-		if (frame->data[2] != _receive_contexts[i]->expected_next_receive_sequence_num) {
-			// DEBUG_SERIAL << F("> Lex: ERROR: expected receive sequence num = ") << _receive_contexts[i]->expected_next_receive_sequence_num << F(" but got = ") << frame->data[2] << endl;
-			(void)(*_messagehandler)(_receive_contexts[i]->buffer, _receive_contexts[i]->receive_buffer_index, _receive_contexts[i]->receive_stream_id, CBUS_LONG_MESSAGE_SEQUENCE_ERROR);
-			_receive_contexts[i]->in_use = false;
+		if (frame->data[2] != _receive_contexts[i].expected_next_receive_sequence_num) {
+			// DEBUG_SERIAL << F("> Lex: ERROR: expected receive sequence num = ") << _receive_contexts[i].expected_next_receive_sequence_num << F(" but got = ") << frame->data[2] << endl;
+			(void)(*_messagehandler)(_receive_contexts[i].buffer, _receive_contexts[i].receive_buffer_index, _receive_contexts[i].receive_stream_id, CBUS_LONG_MESSAGE_SEQUENCE_ERROR);
+			releaseReceiveContext(i);
 			return;
 		}
 
-		// consume up to 5 bytes of message data from this fragment
+		// consume up to 5 bytes of message data from this fragment, folding each into the CRC as it arrives
 		for (j = 0; j < 5; j++) {
 			// DEBUG_SERIAL << F("> Lex: consuming received data byte = ") << (char)frame->data[j + 3] << endl;
-			_receive_contexts[i]->buffer[_receive_contexts[i]->receive_buffer_index] = frame->data[j + 3];
-			++_receive_contexts[i]->receive_buffer_index;
-			++_receive_contexts[i]->incoming_bytes_received;
-			_receive_contexts[i]->last_fragment_received = millis();
+			_receive_contexts[i].buffer[_receive_contexts[i].receive_buffer_index] = frame->data[j + 3];
+
+			if (_use_crc) {
+				_receive_contexts[i].crc = crc16_update(_receive_contexts[i].crc, &frame->data[j + 3], 1);
+			}
+
+			++_receive_contexts[i].receive_buffer_index;
+			++_receive_contexts[i].incoming_bytes_received;
+			_receive_contexts[i].last_fragment_received = CBUSClock::ms();
 
 			// if we have consumed the entire message, surface it to the user's handler
-			if (_receive_contexts[i]->incoming_bytes_received >= _receive_contexts[i]->incoming_message_length) {
+			if (_receive_contexts[i].incoming_bytes_received >= _receive_contexts[i].incoming_message_length) {
 				// DEBUG_SERIAL << F("> Lex: message data has been fully consumed") << endl;
 
-				if (_use_crc && _receive_contexts[i]->incoming_message_crc != 0) {
-					// DEBUG_SERIAL << F("> Lex: calculating CRC16") << endl;
-					tmpcrc = crc16((uint8_t *)_receive_contexts[i]->buffer, _receive_contexts[i]->receive_buffer_index);
+				if (_use_crc && _receive_contexts[i].incoming_message_crc != 0) {
+					tmpcrc = crc16_final(_receive_contexts[i].crc);
 				}
 
-				if (_receive_contexts[i]->incoming_message_crc != tmpcrc) {
-					// DEBUG_SERIAL << F("> Lex: message CRC error, expected = ") << _receive_contexts[i]->incoming_message_crc << F(", calculated = ") << tmpcrc << endl;
+				if (_receive_contexts[i].incoming_message_crc != tmpcrc) {
+					// DEBUG_SERIAL << F("> Lex: message CRC error, expected = ") << _receive_contexts[i].incoming_message_crc << F(", calculated = ") << tmpcrc << endl;
 					status = CBUS_LONG_MESSAGE_CRC_ERROR;
 				} else {
 					status = CBUS_LONG_MESSAGE_COMPLETE;
 				}
 
-				(void)(*_messagehandler)(_receive_contexts[i]->buffer, _receive_contexts[i]->receive_buffer_index, _receive_contexts[i]->receive_stream_id, status);
-				_receive_contexts[i]->in_use = false;
+				(void)(*_messagehandler)(_receive_contexts[i].buffer, _receive_contexts[i].receive_buffer_index, _receive_contexts[i].receive_stream_id, status);
+				releaseReceiveContext(i);
 				break;
 
 				// if the buffer is now full, give the user what we have with an error status
-			} else if (_receive_contexts[i]->receive_buffer_index >= _receive_buffer_len ) {
+			} else if (_receive_contexts[i].receive_buffer_index >= _receive_buffer_len ) {
 				// DEBUG_SERIAL << F("> Lex: buffer is now full, message truncated") << endl;
-				(void)(*_messagehandler)(_receive_contexts[i]->buffer, _receive_contexts[i]->receive_buffer_index, _receive_contexts[i]->receive_stream_id, CBUS_LONG_MESSAGE_TRUNCATED);
-				_receive_contexts[i]->in_use = false;
+				(void)(*_messagehandler)(_receive_contexts[i].buffer, _receive_contexts[i].receive_buffer_index, _receive_contexts[i].receive_stream_id, CBUS_LONG_MESSAGE_TRUNCATED);
+				releaseReceiveContext(i);
 				break;
 			}
 		}
 
 		// increment the expected next sequence number for this stream context
-		++_receive_contexts[i]->expected_next_receive_sequence_num;
+		++_receive_contexts[i].expected_next_receive_sequence_num;
+	}
+
+	return;
+}
+
+//
+/// the receive context index
+/// each slot holds a context number plus one, or zero if empty, and collisions probe forward to the next slot
+/// a fragment finds its context in one or two probes however many contexts are in use
+//
+
+unsigned int CBUSLongMessageEx::rxIndexHash(byte sender_canid, byte stream_id) {
+
+	// multiply by a 16 bit golden ratio constant and take the high byte, which depends on every bit of the key
+	return ((uint16_t)(((uint16_t)sender_canid << 8 | stream_id) * 0x9e37U) >> 8) & _rx_index_mask;
+}
+
+// return the context receiving this stream from this sender, or _num_receive_contexts if none
+
+byte CBUSLongMessageEx::rxIndexFind(byte sender_canid, byte stream_id) {
+
+	if (_rx_index == nullptr) {
+		return _num_receive_contexts;
+	}
+
+	for (unsigned int slot = rxIndexHash(sender_canid, stream_id); _rx_index[slot] != 0; slot = (slot + 1) & _rx_index_mask) {
+		receive_context_t *context = &_receive_contexts[_rx_index[slot] - 1];
+
+		if (context->sender_canid == sender_canid && context->receive_stream_id == stream_id) {
+			return _rx_index[slot] - 1;
+		}
 	}
 
+	return _num_receive_contexts;
+}
+
+void CBUSLongMessageEx::rxIndexInsert(byte context) {
+
+	unsigned int slot = rxIndexHash(_receive_contexts[context].sender_canid, _receive_contexts[context].receive_stream_id);
+
+	while (_rx_index[slot] != 0) {
+		slot = (slot + 1) & _rx_index_mask;
+	}
+
+	_rx_index[slot] = context + 1;
+	return;
+}
+
+// remove a context, shifting back any later entries in the probe sequence that can move into the gap,
+// so lookups never need tombstones
+
+void CBUSLongMessageEx::rxIndexRemove(byte context) {
+
+	unsigned int gap, slot, home;
+
+	for (gap = rxIndexHash(_receive_contexts[context].sender_canid, _receive_contexts[context].receive_stream_id); _rx_index[gap] != context + 1; gap = (gap + 1) & _rx_index_mask) {
+		if (_rx_index[gap] == 0) {
+			return;
+		}
+	}
+
+	for (slot = (gap + 1) & _rx_index_mask; _rx_index[slot] != 0; slot = (slot + 1) & _rx_index_mask) {
+		receive_context_t *entry = &_receive_contexts[_rx_index[slot] - 1];
+		home = rxIndexHash(entry->sender_canid, entry->receive_stream_id);
+
+		// the entry can move if its home slot is not cyclically between the gap and its current slot
+		if (((slot - home) & _rx_index_mask) >= ((slot - gap) & _rx_index_mask)) {
+			_rx_index[gap] = _rx_index[slot];
+			gap = slot;
+		}
+	}
+
+	_rx_index[gap] = 0;
+	return;
+}
+
+void CBUSLongMessageEx::releaseReceiveContext(byte context) {
+
+	rxIndexRemove(context);
+	_receive_contexts[context].in_use = false;
 	return;
 }
 
@@ -885,6 +1143,16 @@ void CBUSLongMessageEx::set_sequential(bool state) {
 	return;
 }
 
+//
+/// set whether the send handler is told of progress after each data fragment
+//
+
+void CBUSLongMessageEx::set_progress(bool state) {
+
+	_send_progress = state;
+	return;
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 //////// CRC implementations
@@ -915,34 +1183,81 @@ uint32_t crc32(const byte *s, size_t n) {
 // represent the 17 bit value.
 */
 
-// http://stjarnhimlen.se/snippets/crc-16.c
+// based on http://stjarnhimlen.se/snippets/crc-16.c, which processes one bit at a time
+// the table-driven version below gives the same results, processing a byte (or a nibble) at a time
+// define CRC16_NIBBLE_TABLE to use a 16 entry table instead of a 256 entry table, for parts with very little flash
 
 #define POLY 0x8408
 
-uint16_t crc16(uint8_t *data_p, uint16_t length) {
+//
+/// the CRC register after shifting in k zero bits -- evaluated at compile time to build the table
+//
+
+static constexpr uint16_t crc16Step(uint16_t crc, byte k) {
+
+	return (k == 0) ? crc : crc16Step((crc & 0x0001) ? (crc >> 1) ^ POLY : (crc >> 1), k - 1);
+}
 
-	uint8_t i;
-	uint16_t data;
-	uint16_t crc = 0xffff;
+#ifdef CRC16_NIBBLE_TABLE
 
-	if (length == 0) {
-		return (~crc);
+static const uint16_t crc16_table[16] PROGMEM = {
+	crc16Step(0x0, 4), crc16Step(0x1, 4), crc16Step(0x2, 4), crc16Step(0x3, 4),
+	crc16Step(0x4, 4), crc16Step(0x5, 4), crc16Step(0x6, 4), crc16Step(0x7, 4),
+	crc16Step(0x8, 4), crc16Step(0x9, 4), crc16Step(0xa, 4), crc16Step(0xb, 4),
+	crc16Step(0xc, 4), crc16Step(0xd, 4), crc16Step(0xe, 4), crc16Step(0xf, 4)
+};
+
+#else
+
+#define CRC16_ROW(n) \
+	crc16Step(n + 0x0, 8), crc16Step(n + 0x1, 8), crc16Step(n + 0x2, 8), crc16Step(n + 0x3, 8), \
+	crc16Step(n + 0x4, 8), crc16Step(n + 0x5, 8), crc16Step(n + 0x6, 8), crc16Step(n + 0x7, 8), \
+	crc16Step(n + 0x8, 8), crc16Step(n + 0x9, 8), crc16Step(n + 0xa, 8), crc16Step(n + 0xb, 8), \
+	crc16Step(n + 0xc, 8), crc16Step(n + 0xd, 8), crc16Step(n + 0xe, 8), crc16Step(n + 0xf, 8)
+
+static const uint16_t crc16_table[256] PROGMEM = {
+	CRC16_ROW(0x00), CRC16_ROW(0x10), CRC16_ROW(0x20), CRC16_ROW(0x30),
+	CRC16_ROW(0x40), CRC16_ROW(0x50), CRC16_ROW(0x60), CRC16_ROW(0x70),
+	CRC16_ROW(0x80), CRC16_ROW(0x90), CRC16_ROW(0xa0), CRC16_ROW(0xb0),
+	CRC16_ROW(0xc0), CRC16_ROW(0xd0), CRC16_ROW(0xe0), CRC16_ROW(0xf0)
+};
+
+#endif
+
+//
+/// incremental interface: crc16_final(crc16_update(crc16_init(), data, length)) == crc16(data, length)
+/// and a message may be passed to crc16_update in any number of pieces
+//
+
+uint16_t crc16_init(void) {
+
+	return 0xffff;
+}
+
+uint16_t crc16_update(uint16_t crc, const uint8_t *data_p, uint16_t length) {
+
+	while (length--) {
+		byte data = *data_p++;
+
+#ifdef CRC16_NIBBLE_TABLE
+		crc = (crc >> 4) ^ pgm_read_word(&crc16_table[(crc ^ data) & 0x0f]);
+		crc = (crc >> 4) ^ pgm_read_word(&crc16_table[(crc ^ (data >> 4)) & 0x0f]);
+#else
+		crc = (crc >> 8) ^ pgm_read_word(&crc16_table[(crc ^ data) & 0xff]);
+#endif
 	}
 
-	do {
-		for (i = 0, data = (uint16_t)0xff & *data_p++;
-		     i < 8;
-		     i++, data >>= 1) {
-			if ((crc & 0x0001) ^ (data & 0x0001))
-				crc = (crc >> 1) ^ POLY;
-			else  crc >>= 1;
-		}
-	} while (--length);
+	return crc;
+}
+
+uint16_t crc16_final(uint16_t crc) {
 
 	crc = ~crc;
-	data = crc;
-	crc = (crc << 8) | (data >> 8 & 0xff);
+	return (crc << 8) | (crc >> 8);
+}
+
+uint16_t crc16(uint8_t *data_p, uint16_t length) {
 
-	return (crc);
+	return crc16_final(crc16_update(crc16_init(), data_p, length));
 }
 